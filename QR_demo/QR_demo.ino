@@ -5,8 +5,10 @@
 #include <Arduino.h>
 #include "esp_camera.h"
 #include "quirc.h"
+#include "qr_protocol.h"
 #include <math.h>
 #include <WiFi.h>
+#include "esp_heap_caps.h"
 
 // ────────── AI‑Thinker pin map ──────────
 #define PWDN_GPIO_NUM   32
@@ -51,6 +53,7 @@ static camera_config_t cam_cfg = {
   .frame_size   = FRAMESIZE_QVGA,   // FRAMESIZE_QQVGA = 160×120, FRAMESIZE_QVGA = 320 x 240, FRAMESIZE_VGA = 640 x 480
   .jpeg_quality = 12,
   .fb_count     = 2,                 // will be overwritten below if no PSRAM
+  .fb_location  = CAMERA_FB_IN_PSRAM,  // leaves internal DRAM to quirc
   .grab_mode    = CAMERA_GRAB_LATEST
 };
 
@@ -61,6 +64,19 @@ const char* password = "orbitalcleaner";          // Match Arduino's AP password
 const char* arduino_ip = "192.168.4.1";    // Arduino's IP address
 const int arduino_port = 8080;              // Port for QR data (different from control port 8080) (change back to 8081 later)
 
+// Telemetry format sent to the Nano: 1 = binary QrFrame (qr_protocol.h),
+// 0 = "QR:<id>,<cx>,<cy>,<w>,<h>" text lines for debugging.
+#define QR_TELEMETRY_BINARY 1
+
+// ────────── Detector tuning ──────────
+#define QR_TRACK_MISSES  5               // frames without a code before full-frame search
+// Bands quirc_end() binarizes and scans at once. A second one runs on a
+// quirc thread pinned to core 0 below captureTask's priority, and needs
+// quirc built with QUIRC_MAX_THREADS=2. It hasn't been shown to be faster
+// on the board yet, so compare the end= time of the [STAT] line at 1 and
+// 2 before raising this.
+#define QR_QUIRC_THREADS 1
+
 // ────────── Globals ──────────
 static struct quirc *qr = nullptr;
 static int img_w = 0, img_h = 0;
@@ -75,7 +91,10 @@ static inline int dist(int x0,int y0,int x1,int y1){
 // ────────── Init helpers ──────────
 static void init_camera()
 {
-  if (!psramFound()) cam_cfg.fb_count = 1;       // single buffer if no PSRAM
+  if (!psramFound()) {                           // single buffer if no PSRAM
+    cam_cfg.fb_count = 1;
+    cam_cfg.fb_location = CAMERA_FB_IN_DRAM;
+  }
 
   esp_err_t err = esp_camera_init(&cam_cfg);
   if (err != ESP_OK) {
@@ -96,9 +115,34 @@ static void init_quirc()
     Serial.println("[ERR] quirc alloc/resize");
     while (true) delay(1);
   }
+  // Chassis shadow and LED glare across the marker defeat a single global
+  // threshold, so binarize per tile. For a faster single-pass global
+  // threshold in even lighting, use QUIRC_THRESHOLD_GLOBAL with
+  // quirc_set_threshold_reuse(qr, 1) instead.
+  quirc_set_threshold_mode(qr, QUIRC_THRESHOLD_TILED);
+  // The docking marker only moves a few pixels per frame, so search near
+  // the last detection until it has been missed for a few frames.
+  quirc_set_tracking(qr, QR_TRACK_MISSES);
+  quirc_set_threads(qr, QR_QUIRC_THREADS);
   Serial.println("[OK] quirc ready");
 }
 
+// Built with QUIRC_SMALL_FOOTPRINT on the ESP32, the detector holds about
+// 75 kB at QVGA, most of it the run table. Two QVGA framebuffers would
+// add 150 kB, more than internal DRAM has free once WiFi is up, so they
+// stay in PSRAM and the detector gets the DRAM. Logged after the first
+// frame, once quirc_begin_external() has freed quirc's own image buffer.
+static void print_quirc_footprint()
+{
+  struct quirc_footprint fp;
+  quirc_get_footprint(qr, &fp);
+  Serial.printf("[OK] quirc %u bytes (runs %u), internal heap free %u "
+                "largest %u\n",
+                (unsigned)fp.total, (unsigned)fp.runs,
+                (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL),
+                (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL));
+}
+
 // ────────── WiFi Connection ──────────
 static void init_wifi()
 {
@@ -143,73 +187,175 @@ static void connect_to_arduino()
   }
 }
 
-// ────────── QR task ──────────
-void qrTask(void*)
+// ────────── Pipeline ──────────
+// captureTask (core 0) → frame_queue → detectTask (core 1) → tx_queue →
+// transmitTask (core 0). A slow TCP write only backs up tx_queue, and the
+// detector always works on the newest frame.
+#define FRAME_QUEUE_LEN   1
+#define TX_QUEUE_LEN      8
+#define QR_ID_MAX        31
+#define STATS_PERIOD_MS 5000
+
+struct QrDetection {
+  char id[QR_ID_MAX + 1];                 // payload, NUL-terminated
+  int cx, cy, w, h;
+  struct quirc_point corners[4];
+  uint32_t timestamp_ms;                  // frame capture time
+};
+
+static QueueHandle_t frame_queue = nullptr;    // camera_fb_t *
+static QueueHandle_t tx_queue = nullptr;       // QrDetection
+
+static volatile uint32_t frames_captured = 0;
+static volatile uint32_t frames_dropped = 0;
+static volatile uint32_t frames_processed = 0;
+static volatile uint32_t codes_decoded = 0;
+static volatile uint32_t tx_dropped = 0;
+static volatile uint32_t tx_sent = 0;
+static volatile uint32_t end_us_total = 0;    // time in quirc_end()
+
+// Stage 1: grab frames. If the detector hasn't taken the previous frame
+// yet, that frame is stale, so hand it back to the driver and queue this one.
+void captureTask(void*)
+{
+  for (;;)
+  {
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (!fb) { vTaskDelay(1); continue; }
+    frames_captured++;
+
+    if (xQueueSend(frame_queue, &fb, 0) != pdTRUE) {
+      camera_fb_t *stale;
+      if (xQueueReceive(frame_queue, &stale, 0) == pdTRUE) {
+        esp_camera_fb_return(stale);
+        frames_dropped++;
+      }
+      if (xQueueSend(frame_queue, &fb, 0) != pdTRUE) {
+        esp_camera_fb_return(fb);
+        frames_dropped++;
+      }
+    }
+  }
+}
+
+// Stage 2: identify and decode.
+void detectTask(void*)
 {
   static struct quirc_code code;
   static struct quirc_data data;
 
   for (;;)
   {
-    camera_fb_t *fb = esp_camera_fb_get();
-    if (!fb) { vTaskDelay(1); continue; }
+    camera_fb_t *fb;
+    if (xQueueReceive(frame_queue, &fb, portMAX_DELAY) != pdTRUE) continue;
+    uint32_t timestamp_ms = fb->timestamp.tv_sec * 1000UL +
+                            fb->timestamp.tv_usec / 1000;
 
-    // copy 19 kB → about 0.2 ms on 240 MHz core
-    uint8_t *dst = quirc_begin(qr, nullptr,nullptr);
-    memcpy(dst, fb->buf, img_w*img_h);
+    // Binarize the framebuffer in place instead of copying it into quirc.
+    // The fb is held until every code has been extracted; with fb_count = 2
+    // the driver captures the next frame into the other buffer meanwhile.
+    if (quirc_begin_external(qr, fb->buf, fb->width, fb->height) < 0) {
+      esp_camera_fb_return(fb);
+      continue;
+    }
+    uint32_t t0 = micros();
     quirc_end(qr);
-    esp_camera_fb_return(fb);
+    end_us_total += micros() - t0;
+    if (frames_processed == 0) print_quirc_footprint();
 
     int n = quirc_count(qr);
     for (int i=0;i<n;++i){
       quirc_extract(qr,i,&code);
       if (quirc_decode(&code,&data)==QUIRC_SUCCESS){
-        int cx=0,cy=0;
-        for(int k=0;k<4;++k){ cx+=code.corners[k].x; cy+=code.corners[k].y; }
-        cx>>=2; cy>>=2;
-        int w=dist(code.corners[0].x,code.corners[0].y,
+        QrDetection det;
+        int len = data.payload_len < QR_ID_MAX ? data.payload_len : QR_ID_MAX;
+        memcpy(det.id, data.payload, len);
+        det.id[len] = '\0';
+
+        det.cx=0; det.cy=0;
+        for(int k=0;k<4;++k){ det.cx+=code.corners[k].x; det.cy+=code.corners[k].y; }
+        det.cx>>=2; det.cy>>=2;
+        det.w=dist(code.corners[0].x,code.corners[0].y,
                    code.corners[1].x,code.corners[1].y);
-        int h=dist(code.corners[1].x,code.corners[1].y,
+        det.h=dist(code.corners[1].x,code.corners[1].y,
                    code.corners[2].x,code.corners[2].y);
-        
-        // Output structured format: QR:<id>,<cx>,<cy>,<width>,<height>\n
-        // Extract QR code ID from payload (first part before comma, or entire payload)
-        Serial.print("QR:");
-        // Print payload as ID (will be parsed on Arduino side)
-        for(int j=0; j<data.payload_len; j++) {
-          Serial.print((char)data.payload[j]);
-        }
-        // Send QR data via WiFi to Arduino
-        String qr_data = "QR:";
-        for(int j=0; j<data.payload_len; j++) {
-          qr_data += (char)data.payload[j];
-        }
-        qr_data += ",";
-        qr_data += String(cx);
-        qr_data += ",";
-        qr_data += String(cy);
-        qr_data += ",";
-        qr_data += String(w);
-        qr_data += ",";
-        qr_data += String(h);
-        qr_data += "\n";
-        
-        // Send via WiFi if connected, otherwise Serial for debugging
-        if (arduino_client.connected()) {
-          arduino_client.print(qr_data);
-        } else {
-          // Fallback to Serial for debugging
-          Serial.print(qr_data);
-          // Try to reconnect
-          connect_to_arduino();
-        }
+        memcpy(det.corners, code.corners, sizeof(det.corners));
+        det.timestamp_ms = timestamp_ms;
+
+        codes_decoded++;
+        if (xQueueSend(tx_queue, &det, 0) != pdTRUE) tx_dropped++;
       }
       taskYIELD();                        // feed watchdog
     }
-    vTaskDelay(1);                        // only 1 ms pause now
+    esp_camera_fb_return(fb);
+    frames_processed++;
+  }
+}
+
+// Stage 3: serialize and send.
+void transmitTask(void*)
+{
+  char line[QR_ID_MAX + 48];
+  uint8_t frame[QR_FRAME_SIZE];
+  uint16_t seq = 0;
+
+  for (;;)
+  {
+    QrDetection det;
+    if (xQueueReceive(tx_queue, &det, portMAX_DELAY) != pdTRUE) continue;
+
+    // Output structured format: QR:<id>,<cx>,<cy>,<width>,<height>\n
+    snprintf(line, sizeof(line), "QR:%s,%d,%d,%d,%d\n",
+             det.id, det.cx, det.cy, det.w, det.h);
+
+    // Send via WiFi if connected, otherwise Serial for debugging
+    if (arduino_client.connected()) {
+#if QR_TELEMETRY_BINARY
+      QrFrame f;
+      f.side = qr_side_from_id(det.id);
+      f.seq = seq++;
+      f.timestamp_ms = det.timestamp_ms;
+      for (int k = 0; k < 4; k++) {
+        f.corner_x[k] = det.corners[k].x;
+        f.corner_y[k] = det.corners[k].y;
+      }
+      qr_frame_encode(f, frame);
+      arduino_client.write(frame, sizeof(frame));
+      Serial.print(line);                 // readable copy for debugging
+#else
+      arduino_client.print(line);
+#endif
+      tx_sent++;
+    } else {
+      // Fallback to Serial for debugging
+      Serial.print(line);
+      // Try to reconnect
+      connect_to_arduino();
+    }
   }
 }
 
+static void print_pipeline_stats()
+{
+  // Mean quirc_end() time over the frames since the last report
+  static uint32_t last_det = 0, last_end_us = 0;
+  uint32_t det = frames_processed, end_us = end_us_total;
+  uint32_t frames = det - last_det;
+  uint32_t mean_us = frames ? (end_us - last_end_us) / frames : 0;
+  last_det = det;
+  last_end_us = end_us;
+
+  Serial.printf("[STAT] frames cap=%u det=%u drop=%u q=%u/%d end=%uus | "
+                "codes=%u tx sent=%u drop=%u q=%u/%d\n",
+                (unsigned)frames_captured, (unsigned)det,
+                (unsigned)frames_dropped,
+                (unsigned)uxQueueMessagesWaiting(frame_queue), FRAME_QUEUE_LEN,
+                (unsigned)mean_us,
+                (unsigned)codes_decoded, (unsigned)tx_sent,
+                (unsigned)tx_dropped,
+                (unsigned)uxQueueMessagesWaiting(tx_queue), TX_QUEUE_LEN);
+}
+
 // ────────── WiFi Connection Task ──────────
 void wifiTask(void*)
 {
@@ -238,9 +384,20 @@ void setup()
   init_camera();
   init_quirc();
 
+  frame_queue = xQueueCreate(FRAME_QUEUE_LEN, sizeof(camera_fb_t *));
+  tx_queue = xQueueCreate(TX_QUEUE_LEN, sizeof(QrDetection));
+  if (!frame_queue || !tx_queue) {
+    Serial.println("[ERR] pipeline queue alloc");
+    while (true) delay(1);
+  }
+
   const uint32_t STACK_WORDS = 16*1024;   // 64 kB
-  xTaskCreatePinnedToCore(qrTask,"qrTask",
+  xTaskCreatePinnedToCore(detectTask,"detectTask",
                           STACK_WORDS,nullptr,4,nullptr,1);
+  xTaskCreatePinnedToCore(captureTask,"captureTask",
+                          4096,nullptr,5,nullptr,0);
+  xTaskCreatePinnedToCore(transmitTask,"transmitTask",
+                          4096,nullptr,3,nullptr,0);
   xTaskCreatePinnedToCore(wifiTask,"wifiTask",
                           4096,nullptr,2,nullptr,0);
   
@@ -251,9 +408,15 @@ void setup()
 }
 
 void loop(){ 
+  static uint32_t last_stats = 0;
+
   // Keep connection alive
   if (arduino_client.connected()) {
     arduino_client.flush();
   }
+  if (millis() - last_stats >= STATS_PERIOD_MS) {
+    last_stats = millis();
+    print_pipeline_stats();
+  }
   vTaskDelay(1000); 
 }
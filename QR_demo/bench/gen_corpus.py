@@ -0,0 +1,331 @@
+"""Generate a synthetic 320x240 grayscale frame corpus for quirc_bench.
+
+Every frame is written as a binary PGM whose file name starts with the
+expected payload (FRONT/BACK/LEFT/RIGHT), or NONE for frames that must not
+decode. The markers are rendered at different distances, roll, yaw (skew),
+blur and lighting so that detector changes can be compared on the same
+inputs. The output is deterministic for a given seed.
+
+Usage: python gen_corpus.py [output_dir] [--seed N]
+"""
+import math
+import os
+import random
+import sys
+
+FRAME_W = 320
+FRAME_H = 240
+FOCAL = 300.0          # pinhole focal length in pixels (roughly the OV2640 at QVGA)
+QUIET = 4              # quiet zone in modules
+
+SIDES = ["FRONT", "BACK", "LEFT", "RIGHT"]
+
+# (version, data codewords, ecc codewords, alignment centre) for ECC level M
+VERSIONS = {
+    1: (16, 10, None),
+    2: (28, 16, 18),
+    3: (44, 26, 22),
+}
+
+# ────────── Minimal QR encoder (byte mode, ECC level M, single block) ──────────
+
+def gf_mul(x, y):
+    z = 0
+    for i in reversed(range(8)):
+        z = (z << 1) ^ ((z >> 7) * 0x11D)
+        z ^= ((y >> i) & 1) * x
+    return z
+
+
+def rs_divisor(degree):
+    result = [0] * (degree - 1) + [1]
+    root = 1
+    for _ in range(degree):
+        for j in range(len(result)):
+            result[j] = gf_mul(result[j], root)
+            if j + 1 < len(result):
+                result[j] ^= result[j + 1]
+        root = gf_mul(root, 0x02)
+    return result
+
+
+def rs_remainder(data, divisor):
+    result = [0] * len(divisor)
+    for b in data:
+        factor = b ^ result.pop(0)
+        result.append(0)
+        for i, coef in enumerate(divisor):
+            result[i] ^= gf_mul(coef, factor)
+    return result
+
+
+def encode_codewords(payload, version):
+    data_len, ecc_len, _ = VERSIONS[version]
+    bits = []
+
+    def put(value, n):
+        for i in reversed(range(n)):
+            bits.append((value >> i) & 1)
+
+    put(0x4, 4)
+    put(len(payload), 8)
+    for c in payload.encode("ascii"):
+        put(c, 8)
+    put(0, min(4, data_len * 8 - len(bits)))
+    while len(bits) % 8:
+        bits.append(0)
+
+    data = [int("".join(map(str, bits[i:i + 8])), 2) for i in range(0, len(bits), 8)]
+    pad = 0xEC
+    while len(data) < data_len:
+        data.append(pad)
+        pad ^= 0xEC ^ 0x11
+    return data + rs_remainder(data, rs_divisor(ecc_len))
+
+
+def encode_qr(payload, version, mask):
+    size = version * 4 + 17
+    modules = [[False] * size for _ in range(size)]
+    function = [[False] * size for _ in range(size)]
+
+    def setf(x, y, dark):
+        modules[y][x] = dark
+        function[y][x] = True
+
+    for i in range(size):
+        setf(6, i, i % 2 == 0)
+        setf(i, 6, i % 2 == 0)
+
+    for cx, cy in ((3, 3), (size - 4, 3), (3, size - 4)):
+        for dy in range(-4, 5):
+            for dx in range(-4, 5):
+                x, y = cx + dx, cy + dy
+                if 0 <= x < size and 0 <= y < size:
+                    setf(x, y, max(abs(dx), abs(dy)) not in (2, 4))
+
+    align = VERSIONS[version][2]
+    if align:
+        for dy in range(-2, 3):
+            for dx in range(-2, 3):
+                setf(align + dx, align + dy, max(abs(dx), abs(dy)) != 1)
+
+    # Format information: ECC level M (00) and the chosen mask
+    fmt = mask
+    rem = fmt
+    for _ in range(10):
+        rem = (rem << 1) ^ ((rem >> 9) * 0x537)
+    fbits = ((fmt << 10) | rem) ^ 0x5412
+
+    def fb(i):
+        return (fbits >> i) & 1 != 0
+
+    for i in range(6):
+        setf(8, i, fb(i))
+    setf(8, 7, fb(6))
+    setf(8, 8, fb(7))
+    setf(7, 8, fb(8))
+    for i in range(9, 15):
+        setf(14 - i, 8, fb(i))
+    for i in range(8):
+        setf(size - 1 - i, 8, fb(i))
+    for i in range(8, 15):
+        setf(8, size - 15 + i, fb(i))
+    setf(8, size - 8, True)
+
+    data = encode_codewords(payload, version)
+    i = 0
+    right = size - 1
+    while right >= 1:
+        if right == 6:
+            right = 5
+        for vert in range(size):
+            for j in range(2):
+                x = right - j
+                upward = ((right + 1) & 2) == 0
+                y = size - 1 - vert if upward else vert
+                if not function[y][x] and i < len(data) * 8:
+                    modules[y][x] = (data[i >> 3] >> (7 - (i & 7))) & 1 != 0
+                    i += 1
+        right -= 2
+
+    mask_fn = [
+        lambda x, y: (x + y) % 2 == 0,
+        lambda x, y: y % 2 == 0,
+        lambda x, y: x % 3 == 0,
+        lambda x, y: (x + y) % 3 == 0,
+        lambda x, y: (x // 3 + y // 2) % 2 == 0,
+        lambda x, y: x * y % 2 + x * y % 3 == 0,
+        lambda x, y: (x * y % 2 + x * y % 3) % 2 == 0,
+        lambda x, y: ((x + y) % 2 + x * y % 3) % 2 == 0,
+    ][mask]
+    for y in range(size):
+        for x in range(size):
+            if not function[y][x] and mask_fn(x, y):
+                modules[y][x] = not modules[y][x]
+    return modules
+
+# ────────── Scene rendering ──────────
+
+def square_to_quad(quad):
+    (x0, y0), (x1, y1), (x2, y2), (x3, y3) = quad
+    dx1, dx2, dx3 = x1 - x2, x3 - x2, x0 - x1 + x2 - x3
+    dy1, dy2, dy3 = y1 - y2, y3 - y2, y0 - y1 + y2 - y3
+    det = dx1 * dy2 - dx2 * dy1
+    g = (dx3 * dy2 - dx2 * dy3) / det
+    h = (dx1 * dy3 - dx3 * dy1) / det
+    return [x1 - x0 + g * x1, x3 - x0 + h * x3, x0,
+            y1 - y0 + g * y1, y3 - y0 + h * y3, y0,
+            g, h, 1.0]
+
+
+def invert3(m):
+    a, b, c, d, e, f, g, h, i = m
+    A, B, C = e * i - f * h, -(d * i - f * g), d * h - e * g
+    det = a * A + b * B + c * C
+    return [A / det, -(b * i - c * h) / det, (b * f - c * e) / det,
+            B / det, (a * i - c * g) / det, -(a * f - c * d) / det,
+            C / det, -(a * h - b * g) / det, (a * e - b * d) / det]
+
+
+def marker_quad(cx, cy, width, roll, yaw):
+    """Project a square of the given apparent width, rotated by roll in its
+    plane and by yaw about the vertical axis, centred on (cx, cy)."""
+    depth = FOCAL
+    half = width / 2.0
+    pts = []
+    for u, v in ((-1, -1), (1, -1), (1, 1), (-1, 1)):
+        x = u * half * math.cos(roll) - v * half * math.sin(roll)
+        y = u * half * math.sin(roll) + v * half * math.cos(roll)
+        z = depth + x * math.sin(yaw)
+        x = x * math.cos(yaw)
+        pts.append((cx + x * FOCAL / z, cy + y * FOCAL / z))
+    return pts
+
+
+def box_blur(img, radius):
+    if radius <= 0:
+        return img
+    w, h = FRAME_W, FRAME_H
+    n = 2 * radius + 1
+    tmp = [0.0] * (w * h)
+    for y in range(h):
+        row = y * w
+        acc = sum(img[row + min(max(x, 0), w - 1)] for x in range(-radius, radius + 1))
+        for x in range(w):
+            tmp[row + x] = acc / n
+            acc += img[row + min(x + radius + 1, w - 1)] - img[row + max(x - radius, 0)]
+    out = [0.0] * (w * h)
+    for x in range(w):
+        acc = sum(tmp[min(max(y, 0), h - 1) * w + x] for y in range(-radius, radius + 1))
+        for y in range(h):
+            out[y * w + x] = acc / n
+            acc += tmp[min(y + radius + 1, h - 1) * w + x] - tmp[max(y - radius, 0) * w + x]
+    return out
+
+
+def render(rng, payload, version, width, roll, yaw, blur, lighting):
+    w, h = FRAME_W, FRAME_H
+    base = rng.uniform(90, 150)
+    grad_x = rng.uniform(-0.15, 0.15)
+    grad_y = rng.uniform(-0.15, 0.15)
+    img = [base + grad_x * (x - w / 2) + grad_y * (y - h / 2)
+           for y in range(h) for x in range(w)]
+
+    # Background clutter: a few dark and light boxes
+    for _ in range(rng.randint(2, 6)):
+        bw, bh = rng.randint(8, 60), rng.randint(8, 60)
+        bx, by = rng.randint(0, w - bw), rng.randint(0, h - bh)
+        level = rng.choice((rng.uniform(20, 60), rng.uniform(180, 230)))
+        for y in range(by, by + bh):
+            for x in range(bx, bx + bw):
+                img[y * w + x] = level
+
+    if payload != "NONE":
+        modules = encode_qr(payload, version, rng.randrange(8))
+        size = len(modules)
+        total = size + 2 * QUIET
+        full_width = width * total / size
+        cx = w / 2 + rng.uniform(-0.25, 0.25) * (w - full_width)
+        cy = h / 2 + rng.uniform(-0.2, 0.2) * max(h - full_width, 0)
+        quad = marker_quad(cx, cy, full_width, roll, yaw)
+        inv = invert3(square_to_quad(quad))
+
+        x_min = max(int(min(p[0] for p in quad)) - 1, 0)
+        x_max = min(int(max(p[0] for p in quad)) + 2, w)
+        y_min = max(int(min(p[1] for p in quad)) - 1, 0)
+        y_max = min(int(max(p[1] for p in quad)) + 2, h)
+
+        dark, light = rng.uniform(15, 45), rng.uniform(200, 240)
+        for y in range(y_min, y_max):
+            for x in range(x_min, x_max):
+                px, py = x + 0.5, y + 0.5
+                den = inv[6] * px + inv[7] * py + inv[8]
+                u = (inv[0] * px + inv[1] * py + inv[2]) / den * total
+                v = (inv[3] * px + inv[4] * py + inv[5]) / den * total
+                if not (0 <= u < total and 0 <= v < total):
+                    continue
+                mu, mv = int(u) - QUIET, int(v) - QUIET
+                is_dark = 0 <= mu < size and 0 <= mv < size and modules[mv][mu]
+                level = dark if is_dark else light
+                if lighting == "shadow":
+                    # Our own chassis shadow across one half of the marker
+                    if u + 0.35 * v > total * 0.6:
+                        level *= 0.3
+                elif lighting == "glare":
+                    # LED hot spot washing out part of the marker
+                    gx, gy = total * 0.3, total * 0.35
+                    d2 = ((u - gx) ** 2 + (v - gy) ** 2) / (total * 0.3) ** 2
+                    level = level + (255 - level) * 0.85 * math.exp(-d2)
+                img[y * w + x] = level
+
+    img = box_blur(img, blur)
+    sigma = rng.uniform(2.0, 5.0)
+    return bytes(min(max(int(p + rng.gauss(0, sigma)), 0), 255) for p in img)
+
+
+def write_pgm(path, pixels):
+    with open(path, "wb") as f:
+        f.write(b"P5\n%d %d\n255\n" % (FRAME_W, FRAME_H))
+        f.write(pixels)
+
+
+def corpus_plan():
+    """Yield (payload, version, width, roll, yaw, blur, lighting)."""
+    for side in SIDES:
+        for width in (40, 64, 100, 160):
+            for yaw in (0.0, 0.6):
+                for blur in (0, 1):
+                    version = 2 if width >= 64 and blur == 0 else 1
+                    yield side, version, width, None, yaw, blur, "normal"
+        for lighting in ("shadow", "glare"):
+            yield side, 2, 110, None, 0.3, 0, lighting
+    for _ in range(6):
+        yield "NONE", 1, 0, 0.0, 0.0, 0, "normal"
+
+
+def main(argv):
+    out_dir = "corpus"
+    seed = 2025
+    args = list(argv)
+    while args:
+        arg = args.pop(0)
+        if arg == "--seed":
+            seed = int(args.pop(0))
+        else:
+            out_dir = arg
+
+    os.makedirs(out_dir, exist_ok=True)
+    rng = random.Random(seed)
+    for n, (payload, version, width, roll, yaw, blur, lighting) in enumerate(corpus_plan()):
+        if roll is None:
+            roll = rng.uniform(-math.pi, math.pi)
+        yaw *= rng.choice((-1, 1))
+        pixels = render(rng, payload, version, width, roll, yaw, blur, lighting)
+        name = "%s_%03d_v%d_w%03d_y%+03d_b%d_%s.pgm" % (
+            payload, n, version, width, int(math.degrees(yaw)), blur, lighting)
+        write_pgm(os.path.join(out_dir, name), pixels)
+        print(name)
+
+
+if __name__ == "__main__":
+    main(sys.argv[1:])
@@ -0,0 +1,497 @@
+/* quirc_bench -- host-side benchmark for the QR_demo copy of quirc
+ *
+ * Replays a corpus of grayscale PGM frames through quirc_begin/quirc_end/
+ * quirc_extract/quirc_decode and reports the time spent in each stage of
+ * the detector along with the decode success rate.
+ *
+ * A frame whose file name starts with a payload followed by '_' (e.g.
+ * "FRONT_012_....pgm") is expected to decode to exactly that payload.
+ * Frames starting with "NONE_" are expected to produce no decode. Any
+ * other frame is replayed for timing only.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "quirc_internal.h"
+
+enum {
+	STAGE_EXTRACT = QUIRC_STAGE_COUNT,
+	STAGE_DECODE,
+	STAGE_TOTAL,
+	NUM_STAGES
+};
+
+static const char *const stage_names[NUM_STAGES] = {
+	[QUIRC_STAGE_OTSU]		= "otsu",
+	[QUIRC_STAGE_PIXELS_SETUP]	= "pixels_setup",
+	[QUIRC_STAGE_LABEL]		= "label",
+	[QUIRC_STAGE_FINDER_SCAN]	= "finder_scan",
+	[QUIRC_STAGE_TEST_GROUPING]	= "test_grouping",
+	[STAGE_EXTRACT]			= "extract",
+	[STAGE_DECODE]			= "decode",
+	[STAGE_TOTAL]			= "total"
+};
+
+struct stage_stats {
+	double		sum;
+	double		max;
+};
+
+struct frame {
+	char		*name;
+	int		w;
+	int		h;
+	uint8_t		*pixels;
+	uint8_t		*scratch;
+};
+
+static struct stage_stats stats[NUM_STAGES];
+static double stage_start[NUM_STAGES];
+static double frame_time[NUM_STAGES];
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+}
+
+static void stage_begin(int stage)
+{
+	stage_start[stage] = now_us();
+}
+
+static void stage_end(int stage)
+{
+	frame_time[stage] += now_us() - stage_start[stage];
+}
+
+void quirc_profile_stage(int stage, int begin)
+{
+	if (begin)
+		stage_begin(stage);
+	else
+		stage_end(stage);
+}
+
+/************************************************************************
+ * Corpus loading
+ */
+
+static int pgm_token(FILE *f, int *value)
+{
+	int c = fgetc(f);
+
+	for (;;) {
+		if (c == '#') {
+			while (c != EOF && c != '\n')
+				c = fgetc(f);
+		} else if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+			c = fgetc(f);
+		} else {
+			break;
+		}
+	}
+
+	if (c < '0' || c > '9')
+		return -1;
+
+	*value = 0;
+	while (c >= '0' && c <= '9') {
+		*value = *value * 10 + (c - '0');
+		c = fgetc(f);
+	}
+
+	return 0;
+}
+
+static int load_pgm(const char *path, struct frame *fr)
+{
+	FILE *f = fopen(path, "rb");
+	int maxval;
+
+	if (!f) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (fgetc(f) != 'P' || fgetc(f) != '5' ||
+	    pgm_token(f, &fr->w) < 0 || pgm_token(f, &fr->h) < 0 ||
+	    pgm_token(f, &maxval) < 0 || maxval != 255 ||
+	    fr->w <= 0 || fr->h <= 0) {
+		fprintf(stderr, "%s: not an 8-bit binary PGM\n", path);
+		fclose(f);
+		return -1;
+	}
+
+	fr->pixels = malloc((size_t)fr->w * fr->h);
+	if (!fr->pixels ||
+	    fread(fr->pixels, 1, (size_t)fr->w * fr->h, f) !=
+	    (size_t)fr->w * fr->h) {
+		fprintf(stderr, "%s: truncated image\n", path);
+		free(fr->pixels);
+		fclose(f);
+		return -1;
+	}
+
+	fclose(f);
+	return 0;
+}
+
+static int is_pgm(const char *name)
+{
+	size_t len = strlen(name);
+
+	return len > 4 && !strcmp(name + len - 4, ".pgm");
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int add_path(const char *path, char ***list, int *count, int *cap)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		DIR *d = opendir(path);
+		struct dirent *ent;
+
+		if (!d) {
+			fprintf(stderr, "%s: %s\n", path, strerror(errno));
+			return -1;
+		}
+
+		while ((ent = readdir(d))) {
+			char *full;
+
+			if (!is_pgm(ent->d_name))
+				continue;
+
+			full = malloc(strlen(path) + strlen(ent->d_name) + 2);
+			sprintf(full, "%s/%s", path, ent->d_name);
+			if (add_path(full, list, count, cap) < 0) {
+				free(full);
+				closedir(d);
+				return -1;
+			}
+			free(full);
+		}
+
+		closedir(d);
+		return 0;
+	}
+
+	if (*count == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		*list = realloc(*list, sizeof(**list) * *cap);
+	}
+
+	(*list)[(*count)++] = strdup(path);
+	return 0;
+}
+
+/************************************************************************
+ * Replay
+ */
+
+static int repeat = 10;
+static int threshold_reuse;
+static int tiled;
+static int tracking;
+static int threads = 1;
+static int external;
+static int dump;
+
+struct result {
+	int		labelled;
+	int		hits;
+	int		misses;
+	int		false_decodes;
+	int		negatives;
+	int		codes;
+	int		decoded;
+};
+
+/* Returns the expected payload length encoded in the file name, 0 for a
+ * NONE frame, or -1 if the frame is unlabelled.
+ */
+static int expected_payload(const char *path, const char **payload)
+{
+	const char *base = strrchr(path, '/');
+	const char *sep;
+
+	base = base ? base + 1 : path;
+	sep = strchr(base, '_');
+	if (!sep || sep == base)
+		return -1;
+
+	*payload = base;
+	if (sep - base == 4 && !strncmp(base, "NONE", 4))
+		return 0;
+
+	return sep - base;
+}
+
+static void run_frame(struct quirc *q, const struct frame *fr,
+		      struct result *res)
+{
+	static struct quirc_code code;
+	static struct quirc_data data;
+	const char *want = NULL;
+	int want_len = expected_payload(fr->name, &want);
+	int found = 0;
+	int wrong = 0;
+	int r, i;
+
+	for (r = 0; r < repeat; r++) {
+		uint8_t *image;
+		int n;
+
+		memset(frame_time, 0, sizeof(frame_time));
+		stage_begin(STAGE_TOTAL);
+
+		if (external) {
+			/* quirc_end() binarizes the buffer in place, so
+			 * each run needs a fresh copy of the frame.
+			 */
+			memcpy(fr->scratch, fr->pixels, (size_t)fr->w * fr->h);
+			quirc_begin_external(q, fr->scratch, fr->w, fr->h);
+		} else {
+			image = quirc_begin(q, NULL, NULL);
+			memcpy(image, fr->pixels, (size_t)fr->w * fr->h);
+		}
+		quirc_end(q);
+
+		n = quirc_count(q);
+		for (i = 0; i < n; i++) {
+			quirc_decode_error_t err;
+
+			stage_begin(STAGE_EXTRACT);
+			quirc_extract(q, i, &code);
+			stage_end(STAGE_EXTRACT);
+
+			stage_begin(STAGE_DECODE);
+			err = quirc_decode(&code, &data);
+			stage_end(STAGE_DECODE);
+
+			if (r)
+				continue;
+
+			res->codes++;
+			if (!err) {
+				res->decoded++;
+				if (want_len > 0 &&
+				    data.payload_len == want_len &&
+				    !memcmp(data.payload, want, want_len))
+					found = 1;
+				else
+					wrong = 1;
+			}
+
+			if (dump) {
+				int k;
+
+				printf("%s %d", fr->name, i);
+				for (k = 0; k < 4; k++)
+					printf(" %d,%d", code.corners[k].x,
+					       code.corners[k].y);
+				if (err)
+					printf(" ERR %s\n",
+					       quirc_strerror(err));
+				else
+					printf(" OK %.*s\n",
+					       data.payload_len,
+					       (const char *)data.payload);
+			}
+		}
+
+		stage_end(STAGE_TOTAL);
+
+		for (i = 0; i < NUM_STAGES; i++) {
+			stats[i].sum += frame_time[i];
+			if (frame_time[i] > stats[i].max)
+				stats[i].max = frame_time[i];
+		}
+	}
+
+	if (want_len < 0)
+		return;
+
+	res->labelled++;
+	if (want_len == 0) {
+		res->negatives++;
+		if (wrong)
+			res->false_decodes++;
+		return;
+	}
+
+	if (found)
+		res->hits++;
+	else
+		res->misses++;
+	if (wrong)
+		res->false_decodes++;
+
+	if (!found && !dump)
+		printf("miss: %s\n", fr->name);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-r repeat] [-t frames] [-a] [-k misses] [-j threads] "
+		"[-x] [-d] "
+		"<frame.pgm | directory>...\n"
+		"\n"
+		"  -r N   process every frame N times (default %d)\n"
+		"  -t N   reuse thresholds for N frames "
+		"(quirc_set_threshold_reuse)\n"
+		"  -a     use tile-local thresholds (QUIRC_THRESHOLD_TILED)\n"
+		"  -k N   track the last code, giving up after N misses "
+		"(quirc_set_tracking)\n"
+		"  -j N   binarize and scan in N bands at once "
+		"(quirc_set_threads)\n"
+		"  -x     pass frames with quirc_begin_external\n"
+		"  -d     dump corners and payload of every grid found\n",
+		prog, repeat);
+}
+
+int main(int argc, char **argv)
+{
+	struct quirc *q;
+	struct quirc_footprint fp;
+	struct result res;
+	char **paths = NULL;
+	int width = 0, height = 0;
+	int count = 0;
+	int cap = 0;
+	int runs;
+	int i;
+
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			repeat = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			threshold_reuse = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-a")) {
+			tiled = 1;
+		} else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+			tracking = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-x")) {
+			external = 1;
+		} else if (!strcmp(argv[i], "-d")) {
+			dump = 1;
+		} else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	if (i >= argc || repeat <= 0) {
+		usage(argv[0]);
+		return 2;
+	}
+
+	for (; i < argc; i++)
+		if (add_path(argv[i], &paths, &count, &cap) < 0)
+			return 1;
+
+	if (!count) {
+		fprintf(stderr, "no frames found\n");
+		return 1;
+	}
+
+	qsort(paths, count, sizeof(paths[0]), compare_names);
+
+	q = quirc_new();
+	if (!q) {
+		fprintf(stderr, "quirc_new: out of memory\n");
+		return 1;
+	}
+
+	quirc_set_threshold_reuse(q, threshold_reuse);
+	if (tiled)
+		quirc_set_threshold_mode(q, QUIRC_THRESHOLD_TILED);
+	quirc_set_tracking(q, tracking);
+	quirc_set_threads(q, threads);
+
+	memset(&res, 0, sizeof(res));
+	for (i = 0; i < count; i++) {
+		struct frame fr;
+		int w, h;
+
+		fr.name = paths[i];
+		if (load_pgm(paths[i], &fr) < 0)
+			return 1;
+
+		quirc_begin(q, &w, &h);
+		if ((w != fr.w || h != fr.h) &&
+		    quirc_resize(q, fr.w, fr.h) < 0) {
+			fprintf(stderr, "quirc_resize: out of memory\n");
+			return 1;
+		}
+
+		fr.scratch = malloc((size_t)fr.w * fr.h);
+		if (!fr.scratch) {
+			fprintf(stderr, "out of memory\n");
+			return 1;
+		}
+
+		run_frame(q, &fr, &res);
+		width = fr.w;
+		height = fr.h;
+		free(fr.scratch);
+		free(fr.pixels);
+		free(paths[i]);
+	}
+
+	free(paths);
+	quirc_get_footprint(q, &fp);
+	quirc_destroy(q);
+
+	runs = count * repeat;
+	printf("\nquirc %s: %d frames x %d runs\n\n",
+	       quirc_version(), count, repeat);
+	printf("%-16s %12s %12s\n", "stage", "mean (us)", "max (us)");
+	for (i = 0; i < NUM_STAGES; i++)
+		printf("%-16s %12.1f %12.1f\n", stage_names[i],
+		       stats[i].sum / runs, stats[i].max);
+
+	printf("\ngrids found:     %d (%d decoded)\n", res.codes, res.decoded);
+	if (res.labelled > res.negatives)
+		printf("decode rate:     %d/%d (%.1f%%)\n", res.hits,
+		       res.labelled - res.negatives,
+		       100.0 * res.hits / (res.labelled - res.negatives));
+	printf("false decodes:   %d (%d negative frames)\n",
+	       res.false_decodes, res.negatives);
+
+	printf("\n%-16s %12s\n", "memory", "bytes");
+	printf("%-16s %12zu\n", "state", fp.state);
+	printf("%-16s %12zu\n", "image", fp.image);
+	printf("%-16s %12zu\n", "pixels", fp.pixels);
+	printf("%-16s %12zu\n", "flood_fill", fp.flood_fill);
+	printf("%-16s %12zu\n", "tiles", fp.tiles);
+	printf("%-16s %12zu\n", "runs", fp.runs);
+	printf("%-16s %12zu (%dx%d)\n", "total", fp.total, width,
+	       height);
+
+	return 0;
+}
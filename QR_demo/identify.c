@@ -18,12 +18,16 @@
 #include <string.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include "quirc_internal.h"
 #ifdef QUIRC_USE_TGMATH
 #include <tgmath.h>
 #else
 #include <math.h>
 #endif // QUIRC_USE_TGMATH
-#include "quirc_internal.h"
+
+#if QUIRC_MAX_THREADS > 1 && defined(ESP_PLATFORM)
+#include "esp_pthread.h"
+#endif
 
 /************************************************************************
  * Linear algebra routines
@@ -123,6 +127,176 @@ static void perspective_unmap(const quirc_float_t *c,
 		den;
 }
 
+#if QUIRC_FIXED_POINT
+/* Largest intermediate magnitude perspective_map_fixed() will divide.
+ * Anything beyond this is far outside any image we could be given.
+ */
+#define QUIRC_FIXED_LIMIT	((int64_t)1 << 29)
+
+static int32_t fixed_from_float(quirc_float_t v, int shift)
+{
+	quirc_float_t s = rint(ldexp(v, shift));
+
+	if (s >= (quirc_float_t)INT32_MAX)
+		return INT32_MAX;
+	if (s <= (quirc_float_t)INT32_MIN)
+		return INT32_MIN;
+
+	return (int32_t)s;
+}
+
+/* Bounds on the error of perspective_map_fixed() against
+ * perspective_map(). Each product is rounded by half a unit, and each
+ * coefficient was rounded by half a unit, which adds up to half a unit
+ * per cell of u and v. The sample offsets are rounded by less than 2^-18
+ * of a cell, which moves the result by that much times the cell size.
+ * When quirc_float_t is single precision, perspective_map() has an error
+ * of its own, which is bounded by 2^-20 of the magnitudes summed.
+ */
+#define QUIRC_FIXED_ERROR	2
+#define QUIRC_FIXED_FLOAT_SHIFT	20
+
+static int32_t fixed_offset_error(int32_t a, int32_t b)
+{
+	return QUIRC_FIXED_ERROR +
+		(int32_t)(((int64_t)llabs(a) + llabs(b)) >> 18);
+}
+
+/* Work out the error bounds of a transform whose coefficients changed */
+static void fixed_set_error(struct quirc_fixed_transform *f)
+{
+	int i;
+
+	f->x_error = fixed_offset_error(f->num[0], f->num[1]);
+	f->y_error = fixed_offset_error(f->num[3], f->num[4]);
+	f->den_error = fixed_offset_error(f->den[0], f->den[1]);
+
+	/* A coefficient out of range saturated, so the transform can only
+	 * be mapped in floating point.
+	 */
+	for (i = 0; i < 6; i++)
+		if (f->num[i] == INT32_MAX || f->num[i] == INT32_MIN)
+			f->x_error = -1;
+	for (i = 0; i < 2; i++)
+		if (f->den[i] == INT32_MAX || f->den[i] == INT32_MIN)
+			f->x_error = -1;
+}
+
+static void perspective_to_fixed(const quirc_float_t *c,
+				 struct quirc_fixed_transform *f)
+{
+	int i;
+
+	for (i = 0; i < 6; i++)
+		f->num[i] = fixed_from_float(c[i], QUIRC_FIXED_SHIFT);
+
+	f->den[0] = fixed_from_float(c[6], QUIRC_FIXED_DEN_SHIFT);
+	f->den[1] = fixed_from_float(c[7], QUIRC_FIXED_DEN_SHIFT);
+	fixed_set_error(f);
+}
+
+/* Round num / den to the nearest integer, where num is in Q16.16 and den
+ * in Q2.30, given bounds on the error of each. den16 is den rounded to
+ * Q16.16 for a 32-bit division, whose remainder settles almost every
+ * case. The few that land near a rounding boundary are checked again
+ * with the full precision of den, and fail if it's still too close to
+ * be sure which way perspective_map() goes. Negative results are all
+ * out of bounds, so they only have to be told apart from zero.
+ */
+static inline int fixed_round(int64_t num, int64_t den, int32_t den16,
+			      int64_t num_error, int64_t den_error, int *ret)
+{
+	const int shift = QUIRC_FIXED_DEN_SHIFT - QUIRC_FIXED_SHIFT;
+	const int32_t d2 = den16 * 2;
+	const int32_t n16 = (int32_t)num * 2 + den16;
+	const int64_t n = num << (shift + 1);
+	/* den16 has up to half a unit more error than den */
+	const int32_t den16_error = (int32_t)(den_error >> shift) + 1;
+	int64_t q2;
+	int32_t q, r, tol;
+
+	num_error *= 2;
+	if (n16 < 0) {
+		*ret = -1;
+		return -n16 > num_error + den16_error ||
+		       -n - den > (num_error << shift) + den_error;
+	}
+
+	q = n16 / d2;
+	r = n16 % d2;
+	tol = (int32_t)num_error + (q * 2 + 1) * den16_error;
+	if (r > tol && d2 - r > tol) {
+		*ret = q;
+		return 1;
+	}
+
+	q2 = (int64_t)q * 2;
+	if ((q2 + 1) * den - n <= (num_error << shift) + (q2 + 1) * den_error ||
+	    n - (q2 - 1) * den <= (num_error << shift) + (q2 + 1) * den_error)
+		return 0;
+
+	*ret = q;
+	return 1;
+}
+
+/* Equivalent of perspective_map() for u and v given in Q16.16. The
+ * products are formed in 64 bits, but the quotients are found with
+ * 32-bit divisions so that they can use the hardware divider.
+ *
+ * Returns 0 when the result can't be trusted to round the same way as
+ * perspective_map(): the point lies too close to a pixel boundary for
+ * the error bounds above, or doesn't map to a sensible location. The
+ * caller then maps it in floating point.
+ */
+static inline int perspective_map_fixed(const struct quirc_fixed_transform *f,
+					int32_t u, int32_t v,
+					struct quirc_point *ret)
+{
+	const int64_t half = (int64_t)1 << (QUIRC_FIXED_SHIFT - 1);
+	const int64_t du = (int64_t)f->den[0] * u;
+	const int64_t dv = (int64_t)f->den[1] * v;
+	const int64_t xu = (int64_t)f->num[0] * u;
+	const int64_t xv = (int64_t)f->num[1] * v;
+	const int64_t yu = (int64_t)f->num[3] * u;
+	const int64_t yv = (int64_t)f->num[4] * v;
+	int64_t den = ((du + dv + half) >> QUIRC_FIXED_SHIFT) +
+		((int64_t)1 << QUIRC_FIXED_DEN_SHIFT);
+	int64_t x = ((xu + xv + half) >> QUIRC_FIXED_SHIFT) + f->num[2];
+	int64_t y = ((yu + yv + half) >> QUIRC_FIXED_SHIFT) + f->num[5];
+	int64_t cells = ((int64_t)abs(u) + abs(v)) >> (QUIRC_FIXED_SHIFT + 1);
+	int64_t x_error = f->x_error + cells;
+	int64_t y_error = f->y_error + cells;
+	int64_t den_error = f->den_error + cells;
+	int32_t den16;
+
+	if (f->x_error < 0 ||
+	    den < ((int64_t)1 << QUIRC_FIXED_DEN_SHIFT) / 16 ||
+	    den >= QUIRC_FIXED_LIMIT << (QUIRC_FIXED_DEN_SHIFT -
+					 QUIRC_FIXED_SHIFT) ||
+	    x <= -QUIRC_FIXED_LIMIT || x >= QUIRC_FIXED_LIMIT ||
+	    y <= -QUIRC_FIXED_LIMIT || y >= QUIRC_FIXED_LIMIT)
+		return 0;
+
+	if (sizeof(quirc_float_t) < sizeof(double)) {
+		x_error += (llabs(xu) + llabs(xv) +
+			    ((int64_t)llabs(f->num[2]) << QUIRC_FIXED_SHIFT)) >>
+			(QUIRC_FIXED_SHIFT + QUIRC_FIXED_FLOAT_SHIFT);
+		y_error += (llabs(yu) + llabs(yv) +
+			    ((int64_t)llabs(f->num[5]) << QUIRC_FIXED_SHIFT)) >>
+			(QUIRC_FIXED_SHIFT + QUIRC_FIXED_FLOAT_SHIFT);
+		den_error += ((llabs(du) + llabs(dv)) >>
+			      (QUIRC_FIXED_SHIFT + QUIRC_FIXED_FLOAT_SHIFT)) +
+			((int64_t)1 << (QUIRC_FIXED_DEN_SHIFT -
+					QUIRC_FIXED_FLOAT_SHIFT));
+	}
+
+	den16 = (int32_t)((den + ((int64_t)1 << 13)) >>
+			  (QUIRC_FIXED_DEN_SHIFT - QUIRC_FIXED_SHIFT));
+	return fixed_round(x, den, den16, x_error, den_error, &ret->x) &&
+	       fixed_round(y, den, den16, y_error, den_error, &ret->y);
+}
+#endif
+
 /************************************************************************
  * Span-based floodfill routine
  */
@@ -145,10 +319,10 @@ static void flood_fill_line(struct quirc *q, int x, int y,
 	left = x;
 	right = x;
 
-	while (left > 0 && row[left - 1] == from)
+	while (left > q->roi_x0 && row[left - 1] == from)
 		left--;
 
-	while (right < q->w - 1 && row[right + 1] == from)
+	while (right < q->roi_x1 - 1 && row[right + 1] == from)
 		right++;
 
 	/* Fill the extent */
@@ -249,7 +423,7 @@ static void flood_fill_seed(struct quirc *q,
 		}
 
 		/* Seed new flood-fills */
-		if (vars->y > 0) {
+		if (vars->y > q->roi_y0) {
 			row = q->pixels + (vars->y - 1) * q->w;
 
 			next_vars = flood_fill_call_next(q, row,
@@ -261,7 +435,7 @@ static void flood_fill_seed(struct quirc *q,
 			}
 		}
 
-		if (vars->y < q->h - 1) {
+		if (vars->y < q->roi_y1 - 1) {
 			row = q->pixels + (vars->y + 1) * q->w;
 
 			next_vars = flood_fill_call_next(q, row,
@@ -288,20 +462,57 @@ static void flood_fill_seed(struct quirc *q,
  * Adaptive thresholding
  */
 
-static uint8_t otsu(const struct quirc *q)
+/* Word-parallel (SWAR) helpers for the histogram and threshold passes.
+ * Four pixels are loaded per iteration. memcpy() keeps the loads legal
+ * for any alignment and compiles to a single 32-bit access.
+ */
+#define SWAR_ONES	0x01010101u
+#define SWAR_HIGH	0x80808080u
+
+static inline uint32_t swar_load(const uint8_t *src)
 {
-	unsigned int numPixels = q->w * q->h;
+	uint32_t v;
 
-	// Calculate histogram
-	unsigned int histogram[UINT8_MAX + 1];
-	(void)memset(histogram, 0, sizeof(histogram));
-	uint8_t* ptr = q->image;
-	unsigned int length = numPixels;
-	while (length--) {
-		uint8_t value = *ptr++;
-		histogram[value]++;
-	}
+	memcpy(&v, src, sizeof(v));
+	return v;
+}
+
+/* For each byte, 0x01 if the byte of x is less than that of y, 0x00
+ * otherwise. The low seven bits are compared with a subtraction that
+ * can't borrow across bytes, and the top bits are then folded in.
+ */
+static inline uint32_t swar_less_than(uint32_t x, uint32_t y)
+{
+	uint32_t d = (x | SWAR_HIGH) - (y & ~SWAR_HIGH);
+	uint32_t lt = (~x & y) | (~(x ^ y) & ~d);
+
+	return (lt & SWAR_HIGH) >> 7;
+}
+
+static inline void histogram_add(unsigned int *histogram, uint32_t v)
+{
+	histogram[v & 0xff]++;
+	histogram[(v >> 8) & 0xff]++;
+	histogram[(v >> 16) & 0xff]++;
+	histogram[v >> 24]++;
+}
+
+static void histogram_build(const struct quirc *q, unsigned int *histogram)
+{
+	const uint8_t *ptr = q->image;
+	unsigned int length = q->w * q->h;
 
+	(void)memset(histogram, 0, sizeof(*histogram) * (UINT8_MAX + 1));
+
+	for (; length >= 4; length -= 4, ptr += 4)
+		histogram_add(histogram, swar_load(ptr));
+
+	while (length--)
+		histogram[*ptr++]++;
+}
+
+static uint8_t otsu(const unsigned int *histogram, unsigned int numPixels)
+{
 	// Calculate weighted sum of histogram values
 	quirc_float_t sum = (quirc_float_t)0;
 	unsigned int i = 0;
@@ -339,20 +550,237 @@ static uint8_t otsu(const struct quirc *q)
 	return threshold;
 }
 
+/************************************************************************
+ * Run-length region labelling
+ */
+
+static int run_find(struct quirc_run *runs, int i)
+{
+	while (runs[i].parent != i) {
+		/* Path halving */
+		runs[i].parent = runs[runs[i].parent].parent;
+		i = runs[i].parent;
+	}
+
+	return i;
+}
+
+/* Join the regions of runs a and b. The root with the lower index, i.e.
+ * the region's first run in raster order, stays the root. Every region's
+ * root is therefore its first run, whatever order runs are joined in.
+ */
+static void run_union(struct quirc_run *runs, int a, int b)
+{
+	a = run_find(runs, a);
+	b = run_find(runs, b);
+
+	if (a < b)
+		runs[b].parent = a;
+	else if (b < a)
+		runs[a].parent = b;
+}
+
+/* Join each run in [above_end, end), one row, to the runs it overlaps in
+ * [above, above_end), the row above.
+ */
+static void join_rows(struct quirc_run *runs, int above, int above_end,
+		      int end)
+{
+	int k = above;
+	int n, i;
+
+	for (n = above_end; n < end; n++) {
+		/* Runs above that end before this one starts can't touch
+		 * this or any later run on the row.
+		 */
+		while (k < above_end && runs[k].x1 < runs[n].x0)
+			k++;
+		for (i = k; i < above_end && runs[i].x0 <= runs[n].x1; i++)
+			run_union(runs, i, n);
+	}
+}
+
+/* Record the runs of dark pixels on row y as the row's run-length code,
+ * and join them to the runs they overlap on the row above, if that row
+ * belongs to the same band. This gives the same 4-connected regions as
+ * the flood fill. Binarization calls this for each row as soon as the
+ * row is done, while it is still in cache.
+ */
+static void label_row(struct quirc_band *band, int y)
+{
+	struct quirc *q = band->q;
+	const quirc_pixel_t *row = q->pixels + y * q->w;
+	struct quirc_run *runs = q->runs;
+	const int first = band->num_runs;
+	int above = first;
+	int n = first;
+	int x = q->roi_x0;
+
+	if (!band->runs_valid || y < q->roi_y0 || y >= q->roi_y1)
+		return;
+
+	if (y > q->roi_y0 && y > band->y0)
+		above = q->row_runs[y - 1];
+	q->row_runs[y] = first;
+
+	while (x < q->roi_x1) {
+		int x0;
+
+		if (!row[x]) {
+			x++;
+#if QUIRC_PIXEL_ALIAS_IMAGE
+			/* Pixels are still 0 or 1 here, so four light or
+			 * four dark pixels load as 0 or SWAR_ONES.
+			 */
+			while (x + 4 <= q->roi_x1 &&
+			       !swar_load((const uint8_t *)row + x))
+				x += 4;
+#endif
+			continue;
+		}
+
+		x0 = x;
+#if QUIRC_PIXEL_ALIAS_IMAGE
+		while (x + 4 <= q->roi_x1 &&
+		       swar_load((const uint8_t *)row + x) == SWAR_ONES)
+			x += 4;
+#endif
+		while (x < q->roi_x1 && row[x])
+			x++;
+
+		if (n >= band->run_end) {
+			band->runs_valid = 0;
+			return;
+		}
+
+		runs[n].x0 = x0;
+		runs[n].x1 = x - 1;
+		runs[n].y = y;
+		runs[n].region = 0;
+		runs[n].parent = n;
+		n++;
+	}
+
+	band->num_runs = n;
+	join_rows(runs, above, first, n);
+}
+
+/* Finish labelling once all bands are merged: point every run at its
+ * root and link each region's runs in raster order.
+ */
+static void label_end(struct quirc *q)
+{
+	struct quirc_run *runs = q->runs;
+	int i;
+
+	if (!q->runs_valid)
+		return;
+
+	/* Parents come before their children, so one forward pass leaves
+	 * every run pointing straight at its root.
+	 */
+	for (i = 0; i < q->num_runs; i++) {
+		runs[i].parent = runs[runs[i].parent].parent;
+		runs[i].next = i;
+	}
+
+	/* Inserting behind the root, last run first, leaves each circular
+	 * list in raster order.
+	 */
+	for (i = q->num_runs - 1; i >= 0; i--) {
+		struct quirc_run *root = &runs[runs[i].parent];
+
+		if (root != &runs[i]) {
+			runs[i].next = root->next;
+			root->next = i;
+		}
+	}
+}
+
+/* The run covering (x, y), or -1 for a light pixel */
+static int run_at(const struct quirc *q, int x, int y)
+{
+	int i;
+
+	for (i = q->row_runs[y]; i < q->row_runs[y + 1]; i++) {
+		if (q->runs[i].x0 > x)
+			break;
+		if (q->runs[i].x1 >= x)
+			return i;
+	}
+
+	return -1;
+}
+
+/* Call func for every run of a region, like a flood fill would for
+ * every span, but without touching the pixels.
+ */
+static void region_spans(const struct quirc *q, int rcode,
+			 span_func_t func, void *user_data)
+{
+	const struct quirc_run *runs = q->runs;
+	int first = q->regions[rcode].run;
+	int i = first;
+
+	do {
+		func(user_data, runs[i].y, runs[i].x0, runs[i].x1);
+		i = runs[i].next;
+	} while (i != first);
+}
+
 static void area_count(void *user_data, int y, int left, int right)
 {
 	((struct quirc_region *)user_data)->count += right - left + 1;
 }
 
+/* The region of a run, seeded at (x, y) on it if it is new. The area is
+ * summed from the region's runs, and the code is remembered on the root
+ * run.
+ */
+static int run_region(struct quirc *q, int run, int x, int y)
+{
+	struct quirc_region *box;
+	struct quirc_run *root = &q->runs[q->runs[run].parent];
+	int region;
+
+	if (root->region)
+		return root->region;
+
+	if (q->num_regions >= QUIRC_MAX_REGIONS)
+		return -1;
+
+	region = q->num_regions;
+	box = &q->regions[q->num_regions++];
+
+	memset(box, 0, sizeof(*box));
+
+	box->seed.x = x;
+	box->seed.y = y;
+	box->capstone = -1;
+	box->run = run;
+
+	region_spans(q, region, area_count, box);
+	root->region = region;
+
+	return region;
+}
+
 static int region_code(struct quirc *q, int x, int y)
 {
 	int pixel;
 	struct quirc_region *box;
 	int region;
 
-	if (x < 0 || y < 0 || x >= q->w || y >= q->h)
+	if (x < q->roi_x0 || y < q->roi_y0 ||
+	    x >= q->roi_x1 || y >= q->roi_y1)
 		return -1;
 
+	if (q->runs_valid) {
+		int run = run_at(q, x, y);
+
+		return run < 0 ? -1 : run_region(q, run, x, y);
+	}
+
 	pixel = q->pixels[y * q->w + x];
 
 	if (pixel >= QUIRC_PIXEL_REGION)
@@ -441,9 +869,12 @@ static void find_region_corners(struct quirc *q,
 
 	memcpy(&psd.ref, ref, sizeof(psd.ref));
 	psd.scores[0] = -1;
-	flood_fill_seed(q, region->seed.x, region->seed.y,
-			rcode, QUIRC_PIXEL_BLACK,
-			find_one_corner, &psd);
+	if (q->runs_valid)
+		region_spans(q, rcode, find_one_corner, &psd);
+	else
+		flood_fill_seed(q, region->seed.x, region->seed.y,
+				rcode, QUIRC_PIXEL_BLACK,
+				find_one_corner, &psd);
 
 	psd.ref.x = psd.corners[0].x - psd.ref.x;
 	psd.ref.y = psd.corners[0].y - psd.ref.y;
@@ -459,9 +890,12 @@ static void find_region_corners(struct quirc *q,
 	psd.scores[1] = i;
 	psd.scores[3] = -i;
 
-	flood_fill_seed(q, region->seed.x, region->seed.y,
-			QUIRC_PIXEL_BLACK, rcode,
-			find_other_corners, &psd);
+	if (q->runs_valid)
+		region_spans(q, rcode, find_other_corners, &psd);
+	else
+		flood_fill_seed(q, region->seed.x, region->seed.y,
+				QUIRC_PIXEL_BLACK, rcode,
+				find_other_corners, &psd);
 }
 
 static void record_capstone(struct quirc *q, int ring, int stone)
@@ -493,14 +927,12 @@ static void record_capstone(struct quirc *q, int ring, int stone)
 	perspective_map(capstone->c, 3.5, 3.5, &capstone->center);
 }
 
-static void test_capstone(struct quirc *q, unsigned int x, unsigned int y,
-			  unsigned int *pb)
+/* Check that ring_left and ring_right are one region surrounding the
+ * stone, with about the area ratio of a capstone, and record it.
+ */
+static void test_capstone_regions(struct quirc *q, int ring_left,
+				  int stone, int ring_right)
 {
-	int ring_right = region_code(q, x - pb[4], y);
-	int stone = region_code(q, x - pb[4] - pb[3] - pb[2], y);
-	int ring_left = region_code(q, x - pb[4] - pb[3] -
-				    pb[2] - pb[1] - pb[0],
-				    y);
 	struct quirc_region *stone_reg;
 	struct quirc_region *ring_reg;
 	unsigned int ratio;
@@ -531,43 +963,60 @@ static void test_capstone(struct quirc *q, unsigned int x, unsigned int y,
 	record_capstone(q, ring_left, stone);
 }
 
+static void test_capstone(struct quirc *q, unsigned int x, unsigned int y,
+			  unsigned int *pb)
+{
+	int ring_right = region_code(q, x - pb[4], y);
+	int stone = region_code(q, x - pb[4] - pb[3] - pb[2], y);
+	int ring_left = region_code(q, x - pb[4] - pb[3] -
+				    pb[2] - pb[1] - pb[0],
+				    y);
+
+	test_capstone_regions(q, ring_left, stone, ring_right);
+}
+
+/* Do five runs, dark-light-dark-light-dark, have the 1:1:3:1:1 widths of
+ * a line through a capstone?
+ */
+static int finder_ratio_ok(const unsigned int *pb)
+{
+	const int scale = 16;
+	static const unsigned int check[5] = {1, 1, 3, 1, 1};
+	unsigned int avg, err;
+	unsigned int i;
+
+	avg = (pb[0] + pb[1] + pb[3] + pb[4]) * scale / 4;
+	err = avg * 3 / 4;
+
+	for (i = 0; i < 5; i++)
+		if (pb[i] * scale < check[i] * avg - err ||
+		    pb[i] * scale > check[i] * avg + err)
+			return 0;
+
+	return 1;
+}
+
 static void finder_scan(struct quirc *q, unsigned int y)
 {
 	quirc_pixel_t *row = q->pixels + y * q->w;
-	unsigned int x;
+	int x;
 	int last_color = 0;
 	unsigned int run_length = 0;
 	unsigned int run_count = 0;
 	unsigned int pb[5];
 
 	memset(pb, 0, sizeof(pb));
-	for (x = 0; x < q->w; x++) {
+	for (x = q->roi_x0; x < q->roi_x1; x++) {
 		int color = row[x] ? 1 : 0;
 
-		if (x && color != last_color) {
+		if (x > q->roi_x0 && color != last_color) {
 			memmove(pb, pb + 1, sizeof(pb[0]) * 4);
 			pb[4] = run_length;
 			run_length = 0;
 			run_count++;
 
-			if (!color && run_count >= 5) {
-				const int scale = 16;
-				static const unsigned int check[5] = {1, 1, 3, 1, 1};
-				unsigned int avg, err;
-				unsigned int i;
-				int ok = 1;
-
-				avg = (pb[0] + pb[1] + pb[3] + pb[4]) * scale / 4;
-				err = avg * 3 / 4;
-
-				for (i = 0; i < 5; i++)
-					if (pb[i] * scale < check[i] * avg - err ||
-					    pb[i] * scale > check[i] * avg + err)
-						ok = 0;
-
-				if (ok)
-					test_capstone(q, x, y, pb);
-			}
+			if (!color && run_count >= 5 && finder_ratio_ok(pb))
+				test_capstone(q, x, y, pb);
 		}
 
 		run_length++;
@@ -575,6 +1024,53 @@ static void finder_scan(struct quirc *q, unsigned int y)
 	}
 }
 
+/* Is run i, with the two runs before it on its row, a line through a
+ * capstone? The lengths of the three dark runs and the two light gaps
+ * between them are the five runs the pixel scan would check.
+ */
+static int finder_run_hit(const struct quirc *q, int i)
+{
+	const struct quirc_run *r = &q->runs[i];
+	unsigned int pb[5];
+
+	pb[0] = r[-2].x1 - r[-2].x0 + 1;
+	pb[1] = r[-1].x0 - r[-2].x1 - 1;
+	pb[2] = r[-1].x1 - r[-1].x0 + 1;
+	pb[3] = r->x0 - r[-1].x1 - 1;
+	pb[4] = r->x1 - r->x0 + 1;
+
+	return finder_ratio_ok(pb);
+}
+
+/* test_capstone() for a hit ending at run i: the three dark runs are the
+ * ring, stone and ring runs themselves.
+ */
+static void test_run_capstone(struct quirc *q, int i)
+{
+	const struct quirc_run *r = &q->runs[i];
+	int ring_right = run_region(q, i, r->x0, r->y);
+	int stone = run_region(q, i - 1, r[-1].x0, r->y);
+	int ring_left = run_region(q, i - 2, r[-2].x0, r->y);
+
+	test_capstone_regions(q, ring_left, stone, ring_right);
+}
+
+/* finder_scan() over a row's run-length code. A dark run only ends a
+ * pattern if light follows it inside the search area.
+ */
+static void finder_scan_runs(struct quirc *q, unsigned int y)
+{
+	const int end = q->row_runs[y + 1];
+	int i;
+
+	for (i = q->row_runs[y] + 2; i < end; i++) {
+		if (q->runs[i].x1 + 1 >= q->roi_x1)
+			break;
+		if (finder_run_hit(q, i))
+			test_run_capstone(q, i);
+	}
+}
+
 static void find_alignment_pattern(struct quirc *q, int index)
 {
 	struct quirc_grid *qr = &q->grids[index];
@@ -683,16 +1179,37 @@ static void measure_grid_size(struct quirc *q, int index)
 	qr->grid_size =  4*ver + 17;
 }
 
+/* Sample offsets within a cell, as used by fitness_cell() */
+static const quirc_float_t cell_offsets[] = {0.3, 0.5, 0.7};
+#if QUIRC_FIXED_POINT
+static const int32_t cell_offsets_fixed[] = {19661, 32768, 45875};
+#endif
+
+/* Map the point at offsets (ou, ov) of cell (x, y) of a grid to the
+ * image, using the currently set perspective transform.
+ */
+static inline void cell_map(const struct quirc_grid *qr, int x, int y,
+			    int ou, int ov, struct quirc_point *p)
+{
+#if QUIRC_FIXED_POINT
+	if (perspective_map_fixed(&qr->fc,
+				  x * QUIRC_FIXED_ONE + cell_offsets_fixed[ou],
+				  y * QUIRC_FIXED_ONE + cell_offsets_fixed[ov],
+				  p))
+		return;
+#endif
+	perspective_map(qr->c, x + cell_offsets[ou], y + cell_offsets[ov], p);
+}
+
 /* Read a cell from a grid using the currently set perspective
  * transform. Returns +/- 1 for black/white, 0 for cells which are
  * out of image bounds.
  */
 static int read_cell(const struct quirc *q, int index, int x, int y)
 {
-	const struct quirc_grid *qr = &q->grids[index];
 	struct quirc_point p;
 
-	perspective_map(qr->c, x + (quirc_float_t)0.5, y + (quirc_float_t)0.5, &p);
+	cell_map(&q->grids[index], x, y, 1, 1, &p);
 	if (p.y < 0 || p.y >= q->h || p.x < 0 || p.x >= q->w)
 		return 0;
 
@@ -707,11 +1224,9 @@ static int fitness_cell(const struct quirc *q, int index, int x, int y)
 
 	for (v = 0; v < 3; v++)
 		for (u = 0; u < 3; u++) {
-			static const quirc_float_t offsets[] = {0.3, 0.5, 0.7};
 			struct quirc_point p;
 
-			perspective_map(qr->c, x + offsets[u],
-					       y + offsets[v], &p);
+			cell_map(qr, x, y, u, v, &p);
 			if (p.y < 0 || p.y >= q->h || p.x < 0 || p.x >= q->w)
 				continue;
 
@@ -805,10 +1320,168 @@ static int fitness_all(const struct quirc *q, int index)
 	return score;
 }
 
+/* Change one parameter of a grid's perspective transform, keeping the
+ * fixed-point sampling copy in step.
+ */
+static void grid_set_param(struct quirc_grid *qr, int j, quirc_float_t value)
+{
+	qr->c[j] = value;
+#if QUIRC_FIXED_POINT
+	if (j < 6)
+		qr->fc.num[j] = fixed_from_float(value, QUIRC_FIXED_SHIFT);
+	else
+		qr->fc.den[j - 6] = fixed_from_float(value,
+						     QUIRC_FIXED_DEN_SHIFT);
+	fixed_set_error(&qr->fc);
+#endif
+}
+
+/* The cells scored by fitness_all(), flattened into a list so that the
+ * pattern geometry is worked out once per grid rather than once per
+ * candidate transform. Each cell is scored with the colour expected
+ * there: +1 for black, -1 for white.
+ */
+#define FITNESS_MAX_APAT	((QUIRC_MAX_ALIGNMENT - 1) * \
+				 (QUIRC_MAX_ALIGNMENT - 1) + \
+				 2 * (QUIRC_MAX_ALIGNMENT - 2))
+#define FITNESS_MAX_CELLS	(8 * QUIRC_MAX_VERSION + 6 + \
+				 3 * 49 + FITNESS_MAX_APAT * 25)
+
+struct fitness_cell_ref {
+	uint8_t			x;
+	uint8_t			y;
+	int8_t			expect;
+};
+
+struct fitness_plan {
+	int			count;
+	struct fitness_cell_ref	cells[FITNESS_MAX_CELLS];
+};
+
+static void plan_cell(struct fitness_plan *plan, int x, int y, int expect)
+{
+	struct fitness_cell_ref *ref = &plan->cells[plan->count++];
+
+	ref->x = x;
+	ref->y = y;
+	ref->expect = expect;
+}
+
+static void plan_ring(struct fitness_plan *plan, int cx, int cy,
+		      int radius, int expect)
+{
+	int i;
+
+	for (i = 0; i < radius * 2; i++) {
+		plan_cell(plan, cx - radius + i, cy - radius, expect);
+		plan_cell(plan, cx - radius, cy + radius - i, expect);
+		plan_cell(plan, cx + radius, cy - radius + i, expect);
+		plan_cell(plan, cx + radius - i, cy + radius, expect);
+	}
+}
+
+static void plan_apat(struct fitness_plan *plan, int cx, int cy)
+{
+	plan_cell(plan, cx, cy, 1);
+	plan_ring(plan, cx, cy, 1, -1);
+	plan_ring(plan, cx, cy, 2, 1);
+}
+
+static void plan_capstone(struct fitness_plan *plan, int x, int y)
+{
+	x += 3;
+	y += 3;
+
+	plan_cell(plan, x, y, 1);
+	plan_ring(plan, x, y, 1, 1);
+	plan_ring(plan, x, y, 2, -1);
+	plan_ring(plan, x, y, 3, 1);
+}
+
+/* Build the same set of cells fitness_all() scores. Returns 0 if the
+ * grid is not a valid QR version, in which case fitness_all() has to be
+ * used directly.
+ */
+static int fitness_plan_setup(const struct quirc_grid *qr,
+			      struct fitness_plan *plan)
+{
+	int version = (qr->grid_size - 17) / 4;
+	const struct quirc_version_info *info;
+	int i, j;
+	int ap_count;
+
+	if (qr->grid_size < 17 || version > QUIRC_MAX_VERSION)
+		return 0;
+
+	info = &quirc_version_db[version];
+	plan->count = 0;
+
+	for (i = 0; i < qr->grid_size - 14; i++) {
+		int expect = (i & 1) ? 1 : -1;
+
+		plan_cell(plan, i + 7, 6, expect);
+		plan_cell(plan, 6, i + 7, expect);
+	}
+
+	plan_capstone(plan, 0, 0);
+	plan_capstone(plan, qr->grid_size - 7, 0);
+	plan_capstone(plan, 0, qr->grid_size - 7);
+
+	ap_count = 0;
+	while ((ap_count < QUIRC_MAX_ALIGNMENT) && info->apat[ap_count])
+		ap_count++;
+
+	for (i = 1; i + 1 < ap_count; i++) {
+		plan_apat(plan, 6, info->apat[i]);
+		plan_apat(plan, info->apat[i], 6);
+	}
+
+	for (i = 1; i < ap_count; i++)
+		for (j = 1; j < ap_count; j++)
+			plan_apat(plan, info->apat[i], info->apat[j]);
+
+	return 1;
+}
+
+/* Score a grid against its plan. Every cell contributes at most +9 (or
+ * +1 when only the cell centres are sampled), so as soon as the score
+ * can no longer exceed the given bound we stop and return something
+ * which doesn't exceed it either. Without early exit, the result is
+ * exactly fitness_all() (or its centre-sampled equivalent).
+ */
+static int fitness_plan_score(const struct quirc *q, int index,
+			      const struct fitness_plan *plan,
+			      int coarse, int bound)
+{
+	const int cell_max = coarse ? 1 : 9;
+	int left = plan->count * cell_max;
+	int score = 0;
+	int i;
+
+	for (i = 0; i < plan->count; i++) {
+		const struct fitness_cell_ref *ref = &plan->cells[i];
+
+		if (coarse)
+			score += read_cell(q, index, ref->x, ref->y) *
+				ref->expect;
+		else
+			score += fitness_cell(q, index, ref->x, ref->y) *
+				ref->expect;
+
+		left -= cell_max;
+		if (score + left <= bound)
+			return score + left;
+	}
+
+	return score;
+}
+
 static void jiggle_perspective(struct quirc *q, int index)
 {
 	struct quirc_grid *qr = &q->grids[index];
-	int best = fitness_all(q, index);
+	struct fitness_plan plan;
+	int have_plan = fitness_plan_setup(qr, &plan);
+	int best = 0;
 	int pass;
 	quirc_float_t adjustments[8];
 	int i;
@@ -817,6 +1490,17 @@ static void jiggle_perspective(struct quirc *q, int index)
 		adjustments[i] = qr->c[i] * (quirc_float_t)0.02;
 
 	for (pass = 0; pass < 5; pass++) {
+		int coarse = have_plan && pass < QUIRC_JIGGLE_COARSE_PASSES;
+
+		/* The score scale changes when we switch from coarse to
+		 * fine sampling, so re-establish the baseline.
+		 */
+		if (!pass || pass == QUIRC_JIGGLE_COARSE_PASSES)
+			best = have_plan ?
+				fitness_plan_score(q, index, &plan, coarse,
+						   INT_MIN) :
+				fitness_all(q, index);
+
 		for (i = 0; i < 16; i++) {
 			int j = i >> 1;
 			int test;
@@ -829,13 +1513,16 @@ static void jiggle_perspective(struct quirc *q, int index)
 			else
 				new = old - step;
 
-			qr->c[j] = new;
-			test = fitness_all(q, index);
+			grid_set_param(qr, j, new);
+			test = have_plan ?
+				fitness_plan_score(q, index, &plan, coarse,
+						   best) :
+				fitness_all(q, index);
 
 			if (test > best)
 				best = test;
 			else
-				qr->c[j] = old;
+				grid_set_param(qr, j, old);
 		}
 
 		for (i = 0; i < 8; i++)
@@ -861,6 +1548,9 @@ static void setup_qr_perspective(struct quirc *q, int index)
 	memcpy(&rect[3], &q->capstones[qr->caps[0]].corners[0],
 	       sizeof(rect[0]));
 	perspective_setup(qr->c, rect, qr->grid_size - 7, qr->grid_size - 7);
+#if QUIRC_FIXED_POINT
+	perspective_to_fixed(qr->c, &qr->fc);
+#endif
 
 	jiggle_perspective(q, index);
 }
@@ -979,12 +1669,19 @@ static void record_qr_grid(struct quirc *q, int a, int b, int c)
 			psd.scores[0] = -hd.y * qr->align.x +
 				hd.x * qr->align.y;
 
-			flood_fill_seed(q, reg->seed.x, reg->seed.y,
-					qr->align_region, QUIRC_PIXEL_BLACK,
-					NULL, NULL);
-			flood_fill_seed(q, reg->seed.x, reg->seed.y,
-					QUIRC_PIXEL_BLACK, qr->align_region,
-					find_leftmost_to_line, &psd);
+			if (q->runs_valid) {
+				region_spans(q, qr->align_region,
+					     find_leftmost_to_line, &psd);
+			} else {
+				flood_fill_seed(q, reg->seed.x, reg->seed.y,
+						qr->align_region,
+						QUIRC_PIXEL_BLACK,
+						NULL, NULL);
+				flood_fill_seed(q, reg->seed.x, reg->seed.y,
+						QUIRC_PIXEL_BLACK,
+						qr->align_region,
+						find_leftmost_to_line, &psd);
+			}
 		}
 	}
 
@@ -1072,47 +1769,773 @@ static void test_grouping(struct quirc *q, unsigned int i)
 	test_neighbours(q, i, &hlist, &vlist);
 }
 
-static void pixels_setup(struct quirc *q, uint8_t threshold)
+/************************************************************************
+ * Binarization in bands
+ */
+
+typedef void (*band_func_t)(struct quirc_band *band);
+
+/* Called by the binarizers for each row of a band as soon as it is done.
+ * With more than one band, finder pattern hits are collected here too,
+ * since test_capstone() has to wait for the merge.
+ */
+static void band_row_done(struct quirc_band *band, int y)
+{
+	label_row(band, y);
+
+#if QUIRC_MAX_THREADS > 1
+	const struct quirc *q = band->q;
+	int i;
+
+	if (q->num_bands < 2 || !band->runs_valid ||
+	    y < q->roi_y0 || y >= q->roi_y1)
+		return;
+
+	for (i = q->row_runs[y] + 2; i < band->num_runs; i++) {
+		if (q->runs[i].x1 + 1 >= q->roi_x1)
+			break;
+		if (finder_run_hit(q, i)) {
+			if (band->num_hits < QUIRC_BAND_HITS)
+				band->hits[band->num_hits] = i;
+			band->num_hits++;
+		}
+	}
+#endif
+}
+
+#if QUIRC_MAX_THREADS > 1
+/* Run the bands of the current job that nobody has taken yet. Called
+ * and returns with the lock held.
+ */
+static void workers_run(struct quirc_workers *w)
+{
+	while (w->next < w->num_bands) {
+		void (*func)(struct quirc_band *band) = w->func;
+		struct quirc_band *band = &w->bands[w->next++];
+
+		pthread_mutex_unlock(&w->lock);
+		func(band);
+		pthread_mutex_lock(&w->lock);
+
+		if (!--w->pending)
+			pthread_cond_signal(&w->done);
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	struct quirc_workers *w = (struct quirc_workers *)arg;
+
+	pthread_mutex_lock(&w->lock);
+	for (;;) {
+		while (!w->quit && w->next >= w->num_bands)
+			pthread_cond_wait(&w->wake, &w->lock);
+		if (w->quit)
+			break;
+
+		workers_run(w);
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return NULL;
+}
+
+void quirc_workers_stop(struct quirc *q)
+{
+	struct quirc_workers *w = q->workers;
+	int i;
+
+	if (!w)
+		return;
+
+	pthread_mutex_lock(&w->lock);
+	w->quit = 1;
+	pthread_cond_broadcast(&w->wake);
+	pthread_mutex_unlock(&w->lock);
+
+	for (i = 0; i < w->num_threads; i++)
+		pthread_join(w->threads[i], NULL);
+
+	pthread_cond_destroy(&w->done);
+	pthread_cond_destroy(&w->wake);
+	pthread_mutex_destroy(&w->lock);
+	free(w);
+	q->workers = NULL;
+}
+
+int quirc_workers_start(struct quirc *q, int count)
+{
+	struct quirc_workers *w;
+#ifdef ESP_PLATFORM
+	esp_pthread_cfg_t cfg = esp_pthread_get_default_config();
+	esp_pthread_cfg_t prev = cfg;
+#endif
+
+	if (count > QUIRC_MAX_THREADS - 1)
+		count = QUIRC_MAX_THREADS - 1;
+	if (q->workers && q->workers->num_threads == count)
+		return count;
+
+	quirc_workers_stop(q);
+	if (count < 1)
+		return 0;
+
+	w = calloc(1, sizeof(*w));
+	if (!w)
+		return 0;
+
+	if (pthread_mutex_init(&w->lock, NULL)) {
+		free(w);
+		return 0;
+	}
+	if (pthread_cond_init(&w->wake, NULL)) {
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+		return 0;
+	}
+	if (pthread_cond_init(&w->done, NULL)) {
+		pthread_cond_destroy(&w->wake);
+		pthread_mutex_destroy(&w->lock);
+		free(w);
+		return 0;
+	}
+
+#ifdef ESP_PLATFORM
+	/* The configuration applies to threads this one creates, so put
+	 * back whatever the caller had afterwards.
+	 */
+	(void)esp_pthread_get_cfg(&prev);
+	cfg.pin_to_core = QUIRC_THREAD_CORE;
+	cfg.prio = QUIRC_THREAD_PRIO;
+	cfg.stack_size = QUIRC_THREAD_STACK;
+	cfg.thread_name = "quirc";
+	esp_pthread_set_cfg(&cfg);
+#endif
+
+	while (w->num_threads < count &&
+	       !pthread_create(&w->threads[w->num_threads], NULL,
+			       worker_thread, w))
+		w->num_threads++;
+
+#ifdef ESP_PLATFORM
+	esp_pthread_set_cfg(&prev);
+#endif
+
+	q->workers = w;
+	count = w->num_threads;
+	if (!count)
+		quirc_workers_stop(q);
+
+	return count;
+}
+#endif
+
+/* Label the search area again as one band, for when a band of a split
+ * image ran out of runs although the whole table might not have.
+ */
+static void relabel_whole(struct quirc *q)
+{
+	struct quirc_band *band = &q->bands[0];
+	int y;
+
+	band->y0 = 0;
+	band->y1 = q->h;
+	band->run0 = 0;
+	band->run_end = q->max_runs;
+	band->num_runs = 0;
+	band->runs_valid = 1;
+	q->num_bands = 1;
+
+	for (y = q->roi_y0; y < q->roi_y1; y++)
+		label_row(band, y);
+
+	q->runs_valid = band->runs_valid;
+	q->num_runs = band->num_runs;
+	q->row_runs[q->roi_y1] = q->num_runs;
+}
+
+/* Gather the bands' runs into one table in raster order, as if the image
+ * had been labelled in one piece, and join the regions that cross band
+ * boundaries.
+ */
+static void bands_merge(struct quirc *q)
+{
+	struct quirc_run *runs = q->runs;
+	int total = 0;
+	int i, k, y;
+
+	q->runs_valid = runs != NULL;
+	for (i = 0; i < q->num_bands; i++)
+		if (!q->bands[i].runs_valid)
+			q->runs_valid = 0;
+
+	if (!q->runs_valid) {
+		if (runs && q->num_bands > 1)
+			relabel_whole(q);
+		return;
+	}
+
+	for (i = 0; i < q->num_bands; i++) {
+		struct quirc_band *band = &q->bands[i];
+		const int count = band->num_runs - band->run0;
+		const int delta = band->run0 - total;
+
+		if (delta) {
+			memmove(runs + total, runs + band->run0,
+				sizeof(*runs) * count);
+			for (k = total; k < total + count; k++)
+				runs[k].parent -= delta;
+			for (y = band->y0; y < band->y1; y++)
+				if (y >= q->roi_y0 && y < q->roi_y1)
+					q->row_runs[y] -= delta;
+#if QUIRC_MAX_THREADS > 1
+			for (k = 0; k < band->num_hits &&
+				    k < QUIRC_BAND_HITS; k++)
+				band->hits[k] -= delta;
+#endif
+		}
+
+		total += count;
+	}
+
+	q->num_runs = total;
+	q->row_runs[q->roi_y1] = total;
+
+	/* Each band's first row still has to be joined to the row above */
+	for (i = 1; i < q->num_bands; i++) {
+		y = q->bands[i].y0;
+		if (y > q->roi_y0 && y < q->roi_y1)
+			join_rows(runs, q->row_runs[y - 1], q->row_runs[y],
+				  q->row_runs[y + 1]);
+	}
+}
+
+/* Binarize the image with func, split into q->num_threads bands of rows
+ * which run at once, the first on this thread and the rest on the
+ * workers. The run table is shared between bands by their number of rows
+ * in the search area.
+ */
+static void binarize(struct quirc *q, band_func_t func, uint8_t threshold,
+		     unsigned int *histogram)
+{
+#if QUIRC_MAX_THREADS > 1
+	const int n = q->workers && q->num_threads > 1 ? q->num_threads : 1;
+#else
+	const int n = 1;
+#endif
+	const int roi_rows = q->roi_y1 - q->roi_y0;
+	int i;
+
+	q->num_bands = n;
+	for (i = 0; i < n; i++) {
+		struct quirc_band *band = &q->bands[i];
+		int r0 = q->h * i / n;
+		int r1 = q->h * (i + 1) / n;
+
+		band->q = q;
+		band->y0 = r0;
+		band->y1 = r1;
+		band->threshold = threshold;
+		band->histogram = histogram;
+
+		/* Rows of the search area above and up to the band's end */
+		r0 = r0 < q->roi_y0 ? 0 : r0 - q->roi_y0;
+		r0 = r0 > roi_rows ? roi_rows : r0;
+		r1 = r1 < q->roi_y0 ? 0 : r1 - q->roi_y0;
+		r1 = r1 > roi_rows ? roi_rows : r1;
+		band->run0 = roi_rows ?
+			(int)((int64_t)q->max_runs * r0 / roi_rows) : 0;
+		band->run_end = roi_rows ?
+			(int)((int64_t)q->max_runs * r1 / roi_rows) : 0;
+		band->num_runs = band->run0;
+		band->runs_valid = q->runs != NULL;
+
+#if QUIRC_MAX_THREADS > 1
+		band->num_hits = 0;
+		if (histogram && n > 1) {
+			band->histogram = band->band_histogram;
+			(void)memset(band->band_histogram, 0,
+				     sizeof(band->band_histogram));
+		}
+#endif
+	}
+
+#if QUIRC_MAX_THREADS > 1
+	if (n > 1) {
+		struct quirc_workers *w = q->workers;
+		int v;
+
+		pthread_mutex_lock(&w->lock);
+		w->func = func;
+		w->bands = q->bands;
+		w->next = 1;
+		w->num_bands = n;
+		w->pending = n - 1;
+		pthread_cond_broadcast(&w->wake);
+		pthread_mutex_unlock(&w->lock);
+
+		func(&q->bands[0]);
+
+		/* A band no worker has got to yet runs here */
+		pthread_mutex_lock(&w->lock);
+		workers_run(w);
+		while (w->pending)
+			pthread_cond_wait(&w->done, &w->lock);
+		pthread_mutex_unlock(&w->lock);
+
+		if (histogram)
+			for (i = 0; i < n; i++)
+				for (v = 0; v <= UINT8_MAX; v++)
+					histogram[v] +=
+						q->bands[i].band_histogram[v];
+	} else
+#endif
+		func(&q->bands[0]);
+
+	bands_merge(q);
+}
+
+/* Binarize a band's rows against one threshold. If the band has a
+ * histogram, it is filled in from the same pass.
+ */
+static void global_rows(struct quirc_band *band)
+{
+	const struct quirc *q = band->q;
+	const uint8_t threshold = band->threshold;
+	unsigned int *histogram = band->histogram;
+	const uint8_t *source = q->image + band->y0 * q->w;
+	quirc_pixel_t *dest = q->pixels + band->y0 * q->w;
+	int y;
+
+	for (y = band->y0; y < band->y1; y++) {
+		int length = q->w;
+
+		if (QUIRC_PIXEL_ALIAS_IMAGE) {
+			const uint32_t t = threshold * SWAR_ONES;
+
+			for (; length >= 4;
+			     length -= 4, source += 4, dest += 4) {
+				uint32_t v = swar_load(source);
+
+				if (histogram)
+					histogram_add(histogram, v);
+
+				v = swar_less_than(v, t);
+				memcpy(dest, &v, sizeof(v));
+			}
+		}
+
+		while (length--) {
+			uint8_t value = *source++;
+
+			if (histogram)
+				histogram[value]++;
+			*dest++ = (value < threshold) ?
+				QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
+		}
+
+		band_row_done(band, y);
+	}
+}
+
+/* Binarize the image. If histogram is given, it is filled in from the
+ * same pass so that the next frame's threshold can be chosen without
+ * another sweep over the image.
+ */
+static void pixels_setup(struct quirc *q, uint8_t threshold,
+			 unsigned int *histogram)
 {
 	if (QUIRC_PIXEL_ALIAS_IMAGE) {
 		q->pixels = (quirc_pixel_t *)q->image;
 	}
 
-	uint8_t* source = q->image;
-	quirc_pixel_t* dest = q->pixels;
-	int length = q->w * q->h;
-	while (length--) {
-		uint8_t value = *source++;
-		*dest++ = (value < threshold) ? QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
-	}
+	if (histogram)
+		(void)memset(histogram, 0,
+			     sizeof(*histogram) * (UINT8_MAX + 1));
+
+	binarize(q, global_rows, threshold, histogram);
 }
 
-uint8_t *quirc_begin(struct quirc *q, int *w, int *h)
+static void begin_frame(struct quirc *q)
 {
 	q->num_regions = QUIRC_PIXEL_REGION;
 	q->num_capstones = 0;
 	q->num_grids = 0;
+}
+
+uint8_t *quirc_begin(struct quirc *q, int *w, int *h)
+{
+	begin_frame(q);
 
 	if (w)
 		*w = q->w;
 	if (h)
 		*h = q->h;
 
+	q->image = q->image_buf;
 	return q->image;
 }
 
+int quirc_begin_external(struct quirc *q, uint8_t *image, int w, int h)
+{
+	if (!image || w != q->w || h != q->h)
+		return -1;
+
+	begin_frame(q);
+
+	/* The caller supplies every image from now on, so the internal
+	 * buffer is no longer needed.
+	 */
+	free(q->image_buf);
+	q->image_buf = NULL;
+
+	q->image = image;
+	return 0;
+}
+
+/* Binarize with one threshold for the whole image, honouring
+ * quirc_set_threshold_reuse().
+ */
+static void threshold_global(struct quirc *q)
+{
+	unsigned int histogram[UINT8_MAX + 1];
+	uint8_t threshold;
+
+	if (q->threshold_reuse && q->threshold_age > 0 &&
+	    q->threshold_age < q->threshold_reuse) {
+		/* Plain threshold pass with the cached threshold */
+		threshold = q->threshold;
+		q->threshold_age++;
+
+		QUIRC_PROFILE_BEGIN(QUIRC_STAGE_PIXELS_SETUP);
+		pixels_setup(q, threshold, NULL);
+		QUIRC_PROFILE_END(QUIRC_STAGE_PIXELS_SETUP);
+	} else if (q->threshold_reuse && q->threshold_age > 0) {
+		/* Threshold with the cached value and gather the histogram
+		 * for its replacement in the same pass.
+		 */
+		QUIRC_PROFILE_BEGIN(QUIRC_STAGE_PIXELS_SETUP);
+		pixels_setup(q, q->threshold, histogram);
+		QUIRC_PROFILE_END(QUIRC_STAGE_PIXELS_SETUP);
+
+		QUIRC_PROFILE_BEGIN(QUIRC_STAGE_OTSU);
+		q->threshold = otsu(histogram, q->w * q->h);
+		q->threshold_age = 1;
+		QUIRC_PROFILE_END(QUIRC_STAGE_OTSU);
+	} else {
+		QUIRC_PROFILE_BEGIN(QUIRC_STAGE_OTSU);
+		histogram_build(q, histogram);
+		threshold = otsu(histogram, q->w * q->h);
+		QUIRC_PROFILE_END(QUIRC_STAGE_OTSU);
+
+		QUIRC_PROFILE_BEGIN(QUIRC_STAGE_PIXELS_SETUP);
+		pixels_setup(q, threshold, NULL);
+		QUIRC_PROFILE_END(QUIRC_STAGE_PIXELS_SETUP);
+
+		q->threshold = threshold;
+		q->threshold_age = 1;
+	}
+}
+
+/************************************************************************
+ * Tile-local thresholding
+ */
+
+/* Choose a threshold for one tile by iterating the midpoint of the dark
+ * and light class means (a cheap, integer-only stand-in for Otsu). The
+ * tile's pixels are also added to the whole-image histogram. Returns 0
+ * if the tile has too little contrast to be thresholded on its own.
+ */
+static uint8_t tile_threshold(const struct quirc *q, int x0, int y0,
+			      unsigned int *global)
+{
+	uint16_t histogram[UINT8_MAX + 1];
+	const int x1 = x0 + QUIRC_TILE_SIZE < q->w ?
+		x0 + QUIRC_TILE_SIZE : q->w;
+	const int y1 = y0 + QUIRC_TILE_SIZE < q->h ?
+		y0 + QUIRC_TILE_SIZE : q->h;
+	unsigned int count = 0;
+	unsigned int sum = 0;
+	int lo, hi;
+	int t, m_low = 0, m_high = 0;
+	int x, y, v, iter;
+
+	(void)memset(histogram, 0, sizeof(histogram));
+	for (y = y0; y < y1; y++) {
+		const uint8_t *row = q->image + y * q->w;
+
+		for (x = x0; x < x1; x++)
+			histogram[row[x]]++;
+	}
+
+	for (lo = 0; !histogram[lo]; lo++)
+		;
+	for (hi = UINT8_MAX; !histogram[hi]; hi--)
+		;
+
+	for (v = lo; v <= hi; v++) {
+		global[v] += histogram[v];
+		count += histogram[v];
+		sum += histogram[v] * v;
+	}
+
+	t = sum / count;
+	for (iter = 0; iter < 4; iter++) {
+		unsigned int c_low = 0, s_low = 0;
+		int next;
+
+		for (v = lo; v < t; v++) {
+			c_low += histogram[v];
+			s_low += histogram[v] * v;
+		}
+
+		if (!c_low || c_low == count)
+			return 0;
+
+		m_low = s_low / c_low;
+		m_high = (sum - s_low) / (count - c_low);
+		next = (m_low + m_high + 1) / 2;
+		if (next == t)
+			break;
+		t = next;
+	}
+
+	if (m_high - m_low < QUIRC_TILE_MIN_CONTRAST)
+		return 0;
+
+	return t;
+}
+
+/* Binarize pixels [x0, x1) of a row against a threshold which moves
+ * linearly from base / (size * size) by step / (size * size) per pixel.
+ */
+static void tile_run(const uint8_t *src, quirc_pixel_t *dst, int x0, int x1,
+		     int base, int step)
+{
+	const int scale = QUIRC_TILE_SIZE * QUIRC_TILE_SIZE;
+	int x;
+
+	for (x = x0; x < x1; x++) {
+		dst[x] = (src[x] * scale < base) ?
+			QUIRC_PIXEL_BLACK : QUIRC_PIXEL_WHITE;
+		base += step;
+	}
+}
+
+/* Binarize a band's rows for threshold_tiled() */
+static void tiled_rows(struct quirc_band *band)
+{
+	const struct quirc *q = band->q;
+	const int ts = QUIRC_TILE_SIZE;
+	const int nx = q->tiles_x;
+	const int ny = q->tiles_y;
+	const uint8_t *tiles = q->tile_thresholds;
+	int i, y;
+
+	for (y = band->y0; y < band->y1; y++) {
+		const uint8_t *src = q->image + y * q->w;
+		quirc_pixel_t *dst = q->pixels + y * q->w;
+		const uint8_t *t0;
+		const uint8_t *t1;
+		int ty = y - ts / 2;
+		int wy = 0;
+		int start;
+
+		/* Vertical weights between the two nearest tile rows */
+		if (ty < 0) {
+			ty = 0;
+		} else if (ty / ts >= ny - 1) {
+			ty = ny - 1;
+		} else {
+			wy = ty % ts;
+			ty /= ts;
+		}
+
+		t0 = tiles + ty * nx;
+		t1 = wy ? t0 + nx : t0;
+
+#define TILE_COL(i)	(t0[i] * (ts - wy) + t1[i] * wy)
+		start = ts / 2 < q->w ? ts / 2 : q->w;
+		tile_run(src, dst, 0, start, TILE_COL(0) * ts, 0);
+
+		for (i = 0; i + 1 < nx; i++) {
+			int end = start + ts < q->w ? start + ts : q->w;
+
+			tile_run(src, dst, start, end, TILE_COL(i) * ts,
+				 TILE_COL(i + 1) - TILE_COL(i));
+			start = end;
+		}
+
+		tile_run(src, dst, start, q->w, TILE_COL(nx - 1) * ts, 0);
+#undef TILE_COL
+
+		band_row_done(band, y);
+	}
+}
+
+/* Binarize against per-tile thresholds, bilinearly interpolated between
+ * tile centres. Tiles without enough contrast of their own (plain
+ * background) use the Otsu threshold of the whole image.
+ */
+static void threshold_tiled(struct quirc *q)
+{
+	const int ts = QUIRC_TILE_SIZE;
+	const int nx = q->tiles_x;
+	const int ny = q->tiles_y;
+	uint8_t *tiles = q->tile_thresholds;
+	unsigned int global[UINT8_MAX + 1];
+	uint8_t global_threshold;
+	int i, x, y;
+
+	if (QUIRC_PIXEL_ALIAS_IMAGE) {
+		q->pixels = (quirc_pixel_t *)q->image;
+	}
+
+	QUIRC_PROFILE_BEGIN(QUIRC_STAGE_OTSU);
+	(void)memset(global, 0, sizeof(global));
+	for (y = 0; y < ny; y++)
+		for (x = 0; x < nx; x++)
+			tiles[y * nx + x] = tile_threshold(q, x * ts, y * ts,
+							   global);
+
+	global_threshold = otsu(global, q->w * q->h);
+	for (i = 0; i < nx * ny; i++)
+		if (!tiles[i])
+			tiles[i] = global_threshold;
+	QUIRC_PROFILE_END(QUIRC_STAGE_OTSU);
+
+	QUIRC_PROFILE_BEGIN(QUIRC_STAGE_PIXELS_SETUP);
+	binarize(q, tiled_rows, 0, NULL);
+	QUIRC_PROFILE_END(QUIRC_STAGE_PIXELS_SETUP);
+}
+
+/* Test the finder pattern hits of a band in raster order, or scan its
+ * rows if it had more than it could keep.
+ */
+static void finder_scan_band(struct quirc *q, const struct quirc_band *band)
+{
+	int y;
+
+#if QUIRC_MAX_THREADS > 1
+	if (q->num_bands > 1 && band->num_hits <= QUIRC_BAND_HITS) {
+		int k;
+
+		for (k = 0; k < band->num_hits; k++)
+			test_run_capstone(q, band->hits[k]);
+		return;
+	}
+#endif
+
+	for (y = band->y0; y < band->y1; y++)
+		if (y >= q->roi_y0 && y < q->roi_y1)
+			finder_scan_runs(q, y);
+}
+
+/************************************************************************
+ * Region-of-interest tracking
+ */
+
+/* Choose the search area for this image: the box recorded around the
+ * last code found, or the whole image.
+ */
+static void track_begin(struct quirc *q)
+{
+	if (q->track_max_misses && q->track_valid) {
+		q->roi_x0 = q->track_min.x;
+		q->roi_y0 = q->track_min.y;
+		q->roi_x1 = q->track_max.x;
+		q->roi_y1 = q->track_max.y;
+	} else {
+		q->roi_x0 = 0;
+		q->roi_y0 = 0;
+		q->roi_x1 = q->w;
+		q->roi_y1 = q->h;
+	}
+}
+
+/* Record a padded box around every grid found for the next image, or
+ * count a miss and give up on the box after too many of them.
+ */
+static void track_end(struct quirc *q)
+{
+	struct quirc_point lo = {q->w, q->h};
+	struct quirc_point hi = {0, 0};
+	int i, k, pad;
+
+	if (!q->track_max_misses)
+		return;
+
+	if (!q->num_grids) {
+		if (q->track_valid && ++q->track_misses >= q->track_max_misses)
+			q->track_valid = 0;
+		return;
+	}
+
+	for (i = 0; i < q->num_grids; i++) {
+		const struct quirc_grid *qr = &q->grids[i];
+
+		for (k = 0; k < 4; k++) {
+			struct quirc_point p;
+
+			perspective_map(qr->c, (k == 1 || k == 2) ?
+					qr->grid_size : 0,
+					k >= 2 ? qr->grid_size : 0, &p);
+			if (p.x < lo.x)
+				lo.x = p.x;
+			if (p.y < lo.y)
+				lo.y = p.y;
+			if (p.x > hi.x)
+				hi.x = p.x;
+			if (p.y > hi.y)
+				hi.y = p.y;
+		}
+	}
+
+	pad = (hi.x - lo.x > hi.y - lo.y ? hi.x - lo.x : hi.y - lo.y) *
+		QUIRC_TRACK_MARGIN / 100;
+	if (pad < QUIRC_TRACK_MIN_PAD)
+		pad = QUIRC_TRACK_MIN_PAD;
+
+	q->track_min.x = lo.x - pad > 0 ? lo.x - pad : 0;
+	q->track_min.y = lo.y - pad > 0 ? lo.y - pad : 0;
+	q->track_max.x = hi.x + pad + 1 < q->w ? hi.x + pad + 1 : q->w;
+	q->track_max.y = hi.y + pad + 1 < q->h ? hi.y + pad + 1 : q->h;
+	q->track_valid = q->track_min.x < q->track_max.x &&
+		q->track_min.y < q->track_max.y;
+	q->track_misses = 0;
+}
+
 void quirc_end(struct quirc *q)
 {
 	int i;
 
-	uint8_t threshold = otsu(q);
-	pixels_setup(q, threshold);
+	track_begin(q);
 
-	for (i = 0; i < q->h; i++)
-		finder_scan(q, i);
+	if (q->threshold_mode == QUIRC_THRESHOLD_TILED)
+		threshold_tiled(q);
+	else
+		threshold_global(q);
 
+	QUIRC_PROFILE_BEGIN(QUIRC_STAGE_LABEL);
+	label_end(q);
+	QUIRC_PROFILE_END(QUIRC_STAGE_LABEL);
+
+	QUIRC_PROFILE_BEGIN(QUIRC_STAGE_FINDER_SCAN);
+	if (q->runs_valid) {
+		for (i = 0; i < q->num_bands; i++)
+			finder_scan_band(q, &q->bands[i]);
+	} else {
+		for (i = q->roi_y0; i < q->roi_y1; i++)
+			finder_scan(q, i);
+	}
+	QUIRC_PROFILE_END(QUIRC_STAGE_FINDER_SCAN);
+
+	QUIRC_PROFILE_BEGIN(QUIRC_STAGE_TEST_GROUPING);
 	for (i = 0; i < q->num_capstones; i++)
 		test_grouping(q, i);
+	QUIRC_PROFILE_END(QUIRC_STAGE_TEST_GROUPING);
+
+	track_end(q);
 }
 
 void quirc_extract(const struct quirc *q, int index,
@@ -36,12 +36,18 @@ struct quirc *quirc_new(void)
 
 void quirc_destroy(struct quirc *q)
 {
-	free(q->image);
+	free(q->image_buf);
 	/* q->pixels may alias q->image when their type representation is of the
 	   same size, so we need to be careful here to avoid a double free */
 	if (!QUIRC_PIXEL_ALIAS_IMAGE)
 		free(q->pixels);
 	free(q->flood_fill_vars);
+	free(q->tile_thresholds);
+	free(q->runs);
+	free(q->row_runs);
+#if QUIRC_MAX_THREADS > 1
+	quirc_workers_stop(q);
+#endif
 	free(q);
 }
 
@@ -52,6 +58,11 @@ int quirc_resize(struct quirc *q, int w, int h)
 	size_t num_vars;
 	size_t vars_byte_size;
 	struct quirc_flood_fill_vars *vars = NULL;
+	int tiles_x, tiles_y;
+	uint8_t *tiles = NULL;
+	int max_runs = 0;
+	struct quirc_run *runs = NULL;
+	int32_t *row_runs = NULL;
 
 	/*
 	 * XXX: w and h should be size_t (or at least unsigned) as negatives
@@ -81,7 +92,8 @@ int quirc_resize(struct quirc *q, int w, int h)
 	 * old buffer when the new size is greater and (b) to write beyond the
 	 * new buffer when the new size is smaller, hence the min computation.
 	 */
-	(void)memcpy(image, q->image, min);
+	if (q->image_buf)
+		(void)memcpy(image, q->image_buf, min);
 
 	/* alloc a new buffer for q->pixels if needed */
 	if (!QUIRC_PIXEL_ALIAS_IMAGE) {
@@ -98,13 +110,14 @@ int quirc_resize(struct quirc *q, int w, int h)
 	 * - rings are the regions which requires the biggest work area.
 	 * - they consumes the most when they are rotated by about 45 degree.
 	 *   in that case, the necessary depth is about (2 * height_of_the_ring).
-	 * - the maximum height of rings would be about 1/3 of the image height.
+	 * - the maximum height of rings would be about 1/3 of the image height
+	 *   (1/QUIRC_RING_HEIGHT_DIV).
 	 */
 
 	if ((size_t)h * 2 / 2 != h) {
 		goto fail; /* size_t overflow */
 	}
-	num_vars = (size_t)h * 2 / 3;
+	num_vars = (size_t)h * 2 / QUIRC_RING_HEIGHT_DIV;
 	if (num_vars == 0) {
 		num_vars = 1;
 	}
@@ -117,10 +130,30 @@ int quirc_resize(struct quirc *q, int w, int h)
 	if (!vars)
 		goto fail;
 
+	/* alloc the per-tile threshold table for QUIRC_THRESHOLD_TILED */
+	tiles_x = (w + QUIRC_TILE_SIZE - 1) / QUIRC_TILE_SIZE;
+	tiles_y = (h + QUIRC_TILE_SIZE - 1) / QUIRC_TILE_SIZE;
+	tiles = malloc(tiles_x > 0 && tiles_y > 0 ? tiles_x * tiles_y : 1);
+	if (!tiles)
+		goto fail;
+
+	/* alloc the run labelling tables. Run coordinates are 16-bit, so
+	 * wider or taller images are always flood filled.
+	 */
+	if (QUIRC_RUN_LABELS && w <= UINT16_MAX && h <= UINT16_MAX &&
+	    (size_t)h * QUIRC_RUNS_PER_ROW <= INT32_MAX) {
+		max_runs = h * QUIRC_RUNS_PER_ROW;
+		runs = malloc(sizeof(*runs) * (max_runs ? max_runs : 1));
+		row_runs = malloc(sizeof(*row_runs) * (h + 1));
+		if (!runs || !row_runs)
+			goto fail;
+	}
+
 	/* alloc succeeded, update `q` with the new size and buffers */
 	q->w = w;
 	q->h = h;
-	free(q->image);
+	free(q->image_buf);
+	q->image_buf = image;
 	q->image = image;
 	if (!QUIRC_PIXEL_ALIAS_IMAGE) {
 		free(q->pixels);
@@ -129,6 +162,23 @@ int quirc_resize(struct quirc *q, int w, int h)
 	free(q->flood_fill_vars);
 	q->flood_fill_vars = vars;
 	q->num_flood_fill_vars = num_vars;
+	free(q->tile_thresholds);
+	q->tile_thresholds = tiles;
+	q->tiles_x = tiles_x;
+	q->tiles_y = tiles_y;
+	free(q->runs);
+	q->runs = runs;
+	free(q->row_runs);
+	q->row_runs = row_runs;
+	q->max_runs = max_runs;
+	q->num_runs = 0;
+	q->runs_valid = 0;
+	q->threshold_age = 0;
+	q->roi_x0 = 0;
+	q->roi_y0 = 0;
+	q->roi_x1 = w;
+	q->roi_y1 = h;
+	q->track_valid = 0;
 
 	return 0;
 	/* NOTREACHED */
@@ -136,10 +186,75 @@ fail:
 	free(image);
 	free(pixels);
 	free(vars);
+	free(tiles);
+	free(runs);
+	free(row_runs);
 
 	return -1;
 }
 
+void quirc_set_threshold_mode(struct quirc *q, quirc_threshold_mode_t mode)
+{
+	q->threshold_mode = mode;
+}
+
+void quirc_set_threshold_reuse(struct quirc *q, int frames)
+{
+	q->threshold_reuse = frames > 0 ? frames : 0;
+	q->threshold_age = 0;
+}
+
+void quirc_set_tracking(struct quirc *q, int max_misses)
+{
+	q->track_max_misses = max_misses > 0 ? max_misses : 0;
+	q->track_misses = 0;
+	q->track_valid = 0;
+}
+
+void quirc_set_threads(struct quirc *q, int threads)
+{
+	if (threads > QUIRC_MAX_THREADS)
+		threads = QUIRC_MAX_THREADS;
+#if QUIRC_MAX_THREADS > 1
+	threads = 1 + quirc_workers_start(q, threads - 1);
+#endif
+	q->num_threads = threads > 1 ? threads : 1;
+}
+
+void quirc_get_roi(const struct quirc *q, int *x, int *y, int *w, int *h)
+{
+	if (x)
+		*x = q->roi_x0;
+	if (y)
+		*y = q->roi_y0;
+	if (w)
+		*w = q->roi_x1 - q->roi_x0;
+	if (h)
+		*h = q->roi_y1 - q->roi_y0;
+}
+
+void quirc_get_footprint(const struct quirc *q, struct quirc_footprint *fp)
+{
+	memset(fp, 0, sizeof(*fp));
+	fp->state = sizeof(*q);
+	if (q->image_buf)
+		fp->image = (size_t)q->w * q->h;
+	if (!QUIRC_PIXEL_ALIAS_IMAGE && q->pixels)
+		fp->pixels = (size_t)q->w * q->h * sizeof(quirc_pixel_t);
+	if (q->flood_fill_vars)
+		fp->flood_fill = q->num_flood_fill_vars *
+			sizeof(*q->flood_fill_vars);
+	if (q->tile_thresholds)
+		fp->tiles = q->tiles_x > 0 && q->tiles_y > 0 ?
+			(size_t)q->tiles_x * q->tiles_y : 1;
+	if (q->runs)
+		fp->runs = sizeof(*q->runs) * (q->max_runs ? q->max_runs : 1) +
+			sizeof(*q->row_runs) * (q->h + 1);
+
+	fp->total = fp->state + fp->image + fp->pixels + fp->flood_fill +
+		fp->tiles + fp->runs;
+}
+
 int quirc_count(const struct quirc *q)
 {
 	return q->num_grids;
@@ -17,6 +17,7 @@
 #ifndef QUIRC_H_
 #define QUIRC_H_
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -56,6 +57,100 @@ int quirc_resize(struct quirc *q, int w, int h);
 uint8_t *quirc_begin(struct quirc *q, int *w, int *h);
 void quirc_end(struct quirc *q);
 
+/* Alternative to quirc_begin() for processing an image in a buffer owned
+ * by the caller, such as a camera framebuffer, without copying it. The
+ * image must be w by h grayscale pixels, where w and h match the last
+ * quirc_resize(). Returns 0 on success, or -1 if the size doesn't match.
+ *
+ * quirc_end() binarizes the buffer in place, and quirc_extract() reads
+ * the result, so the buffer must stay valid and unmodified until all
+ * codes have been extracted.
+ *
+ * The first call frees the internal image buffer. After that,
+ * quirc_begin() returns NULL until quirc_resize() is called again.
+ */
+int quirc_begin_external(struct quirc *q, uint8_t *image, int w, int h);
+
+/* Binarization methods used by quirc_end(). */
+typedef enum {
+	/* One Otsu threshold for the whole image (the default) */
+	QUIRC_THRESHOLD_GLOBAL = 0,
+
+	/* A threshold per 16x16 tile, interpolated between tiles. Copes
+	 * with shadows and glare across a code, at a little over twice
+	 * the cost of the global threshold.
+	 */
+	QUIRC_THRESHOLD_TILED
+} quirc_threshold_mode_t;
+
+/* Select the binarization method. Threshold reuse (below) only applies
+ * to QUIRC_THRESHOLD_GLOBAL.
+ */
+void quirc_set_threshold_mode(struct quirc *q, quirc_threshold_mode_t mode);
+
+/* By default, quirc_end() picks the binarization threshold from the
+ * histogram of each image (Otsu's method), which costs a separate pass
+ * over the image before it can be thresholded. For video, where lighting
+ * changes slowly from frame to frame, the threshold of an earlier frame
+ * can be reused instead:
+ *
+ *   frames = 0: compute the threshold from each image (the default).
+ *   frames = 1: threshold each image with the previous image's threshold,
+ *               gathering the histogram for the next one in the same pass.
+ *   frames > 1: as for 1, but the histogram is only gathered on every
+ *               n-th image. The others are thresholded without one.
+ *
+ * The first image after this call or after quirc_resize() always gets
+ * its own threshold.
+ */
+void quirc_set_threshold_reuse(struct quirc *q, int frames);
+
+/* Enable region-of-interest tracking for video. While enabled, each
+ * quirc_end() that finds a code records a padded box around it, and the
+ * following images are only searched for capstones inside that box. The
+ * whole image is still binarized, so grids reaching past the box are
+ * sampled correctly. After max_misses consecutive images without a code,
+ * quirc_end() goes back to searching the whole image.
+ *
+ * max_misses = 0 disables tracking (the default). The box is forgotten
+ * by this call and by quirc_resize().
+ */
+void quirc_set_tracking(struct quirc *q, int max_misses);
+
+/* Split quirc_end()'s binarization, run coding and capstone search into
+ * this many bands of rows, each handled by its own thread, and merge them
+ * in order afterwards. The codes found are the same as with one thread.
+ * Values are clamped to 1 (the default) .. QUIRC_MAX_THREADS, a build
+ * option which is 1 unless set. More than one thread needs POSIX
+ * threads. The extra threads are started here and kept until
+ * quirc_destroy() or the next call; if they can't be, fewer are used.
+ */
+void quirc_set_threads(struct quirc *q, int threads);
+
+/* Obtain the area searched by the last quirc_end(). Any pointer may be
+ * NULL. Without tracking, or with no code being tracked, this is the
+ * whole image.
+ */
+void quirc_get_roi(const struct quirc *q, int *x, int *y, int *w, int *h);
+
+/* Memory held by a QR-code recognizer, in bytes. state is the recognizer
+ * structure, whose size is fixed at build time by the capacity limits in
+ * quirc_internal.h (see QUIRC_SMALL_FOOTPRINT). The others are buffers
+ * sized by quirc_resize(): image is 0 after quirc_begin_external().
+ */
+struct quirc_footprint {
+	size_t	state;
+	size_t	image;
+	size_t	pixels;
+	size_t	flood_fill;
+	size_t	tiles;
+	size_t	runs;
+	size_t	total;
+};
+
+/* Report the memory held by q. */
+void quirc_get_footprint(const struct quirc *q, struct quirc_footprint *fp);
+
 /* This structure describes a location in the input image buffer. */
 struct quirc_point {
 	int	x;
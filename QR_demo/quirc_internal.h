@@ -28,11 +28,67 @@
 #define QUIRC_PIXEL_BLACK	1
 #define QUIRC_PIXEL_REGION	2
 
+/* Capacity profile. QUIRC_SMALL_FOOTPRINT sizes the tables embedded in
+ * struct quirc and the work areas allocated by quirc_resize() for a few
+ * codes in view at once, and switches the transforms to single
+ * precision. At 320x240 this takes the memory held by the detector from
+ * about 140 kB to 75 kB, most of it the run table (see
+ * quirc_get_footprint()). It is the default on the ESP32, where the
+ * detector has to fit in internal SRAM. Each limit can still be set on
+ * its own.
+ */
+#ifndef QUIRC_SMALL_FOOTPRINT
+#ifdef ESP_PLATFORM
+#define QUIRC_SMALL_FOOTPRINT	1
+#else
+#define QUIRC_SMALL_FOOTPRINT	0
+#endif
+#endif
+
+#if QUIRC_SMALL_FOOTPRINT
+#ifndef QUIRC_MAX_REGIONS
+#define QUIRC_MAX_REGIONS	160
+#endif
+#ifndef QUIRC_MAX_CAPSTONES
+#define QUIRC_MAX_CAPSTONES	16
+#endif
+#ifndef QUIRC_MAX_GRIDS
+#define QUIRC_MAX_GRIDS		8
+#endif
+#ifndef QUIRC_RING_HEIGHT_DIV
+#define QUIRC_RING_HEIGHT_DIV	4
+#endif
+/* The most runs in any frame of the bench corpora with the tiled
+ * threshold is 4312 at 320x240, just under 18 a row. A frame with more
+ * falls back to flood filling.
+ */
+#ifndef QUIRC_RUNS_PER_ROW
+#define QUIRC_RUNS_PER_ROW	18
+#endif
+#ifndef QUIRC_FLOAT_TYPE
+#define QUIRC_FLOAT_TYPE	float
+#define QUIRC_USE_TGMATH
+#endif
+#endif
+
 #ifndef QUIRC_MAX_REGIONS
 #define QUIRC_MAX_REGIONS	254
 #endif
+#ifndef QUIRC_MAX_CAPSTONES
 #define QUIRC_MAX_CAPSTONES	32
+#endif
+#ifndef QUIRC_MAX_GRIDS
 #define QUIRC_MAX_GRIDS		(QUIRC_MAX_CAPSTONES * 2)
+#endif
+
+/* The flood-fill work area holds 2 / QUIRC_RING_HEIGHT_DIV entries per
+ * image row, enough for a ring up to 1 / QUIRC_RING_HEIGHT_DIV of the
+ * image height (see quirc_resize()). Taller shapes are left partly
+ * filled.
+ */
+#ifndef QUIRC_RING_HEIGHT_DIV
+#define QUIRC_RING_HEIGHT_DIV	3
+#endif
 
 #define QUIRC_PERSPECTIVE_PARAMS	8
 
@@ -60,12 +116,223 @@ typedef QUIRC_FLOAT_TYPE quirc_float_t;
 typedef double quirc_float_t;
 #endif
 
+/* Tile size and minimum contrast for QUIRC_THRESHOLD_TILED. A tile whose
+ * dark and light pixels differ by less than the minimum contrast (in grey
+ * levels) is treated as plain background and uses the global threshold.
+ * The tile table takes one byte per tile (300 bytes at 320x240).
+ */
+#ifndef QUIRC_TILE_SIZE
+#define QUIRC_TILE_SIZE			16
+#endif
+#ifndef QUIRC_TILE_MIN_CONTRAST
+#define QUIRC_TILE_MIN_CONTRAST		24
+#endif
+
+/* Margin added around a tracked code's bounding box by quirc_set_tracking(),
+ * as a percentage of the box's larger side, and never less than
+ * QUIRC_TRACK_MIN_PAD pixels. The margin has to cover the code's movement
+ * between two frames.
+ */
+#ifndef QUIRC_TRACK_MARGIN
+#define QUIRC_TRACK_MARGIN		50
+#endif
+#ifndef QUIRC_TRACK_MIN_PAD
+#define QUIRC_TRACK_MIN_PAD		16
+#endif
+
+/* As each row of the search area is binarized, its dark pixels are
+ * stored as runs, and runs are joined into regions by union-find. The
+ * finder scan then works on run lengths, and region areas and spans
+ * come from the run lists instead of flood fills. The run table holds
+ * QUIRC_RUNS_PER_ROW runs per image row on average (16 bytes each); a
+ * frame with more runs than that falls back to the pixel scan and flood
+ * filling. Set QUIRC_RUN_LABELS to 0 to always do so and not allocate
+ * the table.
+ */
+#ifndef QUIRC_RUN_LABELS
+#define QUIRC_RUN_LABELS		1
+#endif
+#ifndef QUIRC_RUNS_PER_ROW
+#define QUIRC_RUNS_PER_ROW		32
+#endif
+
+/* quirc_end() can binarize, run-code and finder-scan the image as up to
+ * QUIRC_MAX_THREADS bands of rows at once, on POSIX threads (see
+ * quirc_set_threads()). The bands are merged in order afterwards, so the
+ * result is the same as with one thread. A band records up to
+ * QUIRC_BAND_HITS finder pattern hits for the merge; one with more is
+ * scanned again. Capstone testing and grouping stay on one thread, so
+ * this is 1 by default, which leaves the threading out of the build.
+ */
+#ifndef QUIRC_MAX_THREADS
+#define QUIRC_MAX_THREADS		1
+#endif
+#ifndef QUIRC_BAND_HITS
+#define QUIRC_BAND_HITS			64
+#endif
+
+#if QUIRC_MAX_THREADS > 1
+#include <pthread.h>
+
+/* The bands beyond the first run on threads started by
+ * quirc_set_threads() and kept until quirc_destroy(). On the ESP32 they
+ * are pinned to QUIRC_THREAD_CORE, away from a caller on the other core,
+ * at QUIRC_THREAD_PRIO, which should be no higher than the caller's so
+ * that the bands never get in each other's way.
+ */
+#ifdef ESP_PLATFORM
+#ifndef QUIRC_THREAD_CORE
+#define QUIRC_THREAD_CORE		0
+#endif
+#ifndef QUIRC_THREAD_PRIO
+#define QUIRC_THREAD_PRIO		4
+#endif
+#ifndef QUIRC_THREAD_STACK
+#define QUIRC_THREAD_STACK		4096
+#endif
+#endif
+#endif
+
+/* jiggle_perspective() refines each grid's transform over five passes of
+ * halving step size. The first QUIRC_JIGGLE_COARSE_PASSES of them score
+ * candidate transforms by the centre of each reference cell only, rather
+ * than the full 3x3 stencil, which is about nine times cheaper. The large
+ * early steps don't need the extra precision. Set this to 0 to get the
+ * original full-stencil refinement.
+ */
+#ifndef QUIRC_JIGGLE_COARSE_PASSES
+#define QUIRC_JIGGLE_COARSE_PASSES	2
+#endif
+
+/* Grid cells can be sampled with a fixed-point copy of the perspective
+ * transform instead of quirc_float_t. The transform itself is still set up
+ * and refined in floating point, but the per-sample mapping done while
+ * scoring and reading a grid uses only integer arithmetic. This is off by
+ * default: on the ESP32 the small-footprint profile already samples in
+ * single precision on the FPU, and the fixed path hasn't been timed
+ * against it there.
+ */
+#ifndef QUIRC_FIXED_POINT
+#define QUIRC_FIXED_POINT	0
+#endif
+
+#if QUIRC_FIXED_POINT
+#define QUIRC_FIXED_SHIFT	16
+#define QUIRC_FIXED_ONE		((int32_t)1 << QUIRC_FIXED_SHIFT)
+#define QUIRC_FIXED_DEN_SHIFT	30
+
+struct quirc_fixed_transform {
+	/* c[0..5] of the float transform in Q16.16 */
+	int32_t			num[6];
+	/* c[6..7] of the float transform in Q2.30 */
+	int32_t			den[2];
+	/* Error bounds of the numerators in Q16.16 and of the denominator in
+	 * Q2.30, with x_error -1 if a coefficient saturated (see
+	 * perspective_map_fixed())
+	 */
+	int32_t			x_error;
+	int32_t			y_error;
+	int32_t			den_error;
+};
+#endif
+
+/* Stages of quirc_end(), for host-side profiling. When QUIRC_PROFILE is
+ * defined, the program linking quirc must provide quirc_profile_stage(),
+ * which is called with begin = 1 before and begin = 0 after each stage
+ * (see bench/quirc_bench.c). Otherwise the markers compile to nothing.
+ */
+enum {
+	QUIRC_STAGE_OTSU,
+	QUIRC_STAGE_PIXELS_SETUP,
+	QUIRC_STAGE_LABEL,
+	QUIRC_STAGE_FINDER_SCAN,
+	QUIRC_STAGE_TEST_GROUPING,
+	QUIRC_STAGE_COUNT
+};
+
+#ifdef QUIRC_PROFILE
+void quirc_profile_stage(int stage, int begin);
+#define QUIRC_PROFILE_BEGIN(s)	quirc_profile_stage((s), 1)
+#define QUIRC_PROFILE_END(s)	quirc_profile_stage((s), 0)
+#else
+#define QUIRC_PROFILE_BEGIN(s)	do { } while (0)
+#define QUIRC_PROFILE_END(s)	do { } while (0)
+#endif
+
 struct quirc_region {
 	struct quirc_point	seed;
 	int			count;
 	int			capstone;
+	/* One of the region's runs when the frame was run-labelled */
+	int			run;
+};
+
+/* A horizontal run of dark pixels, [x0, x1] on row y. parent is the
+ * union-find link; once labelling is done it points straight at the
+ * region's root run, which points to itself, and the runs of each region
+ * are linked in raster order into a circular list through next. region
+ * is the code handed out for a root by region_code(), or 0.
+ */
+struct quirc_run {
+	uint16_t		x0;
+	uint16_t		x1;
+	uint16_t		y;
+	uint16_t		region;
+	int32_t			parent;
+	int32_t			next;
+};
+
+/* One band of rows of quirc_end()'s binarization. The band thresholds
+ * rows [y0, y1) and run-codes those in the search area into its own part
+ * of the run table, runs[run0, run_end), using runs up to num_runs.
+ * runs_valid is cleared when that part fills up.
+ */
+struct quirc_band {
+	struct quirc		*q;
+	int			y0;
+	int			y1;
+	uint8_t			threshold;
+	unsigned int		*histogram;
+
+	int			run0;
+	int			run_end;
+	int			num_runs;
+	int			runs_valid;
+
+#if QUIRC_MAX_THREADS > 1
+	/* Histogram of the band's rows, summed into the frame's one */
+	unsigned int		band_histogram[UINT8_MAX + 1];
+
+	/* Right-hand ring runs of finder pattern hits, in raster order.
+	 * num_hits keeps counting past QUIRC_BAND_HITS.
+	 */
+	int			num_hits;
+	int			hits[QUIRC_BAND_HITS];
+#endif
 };
 
+#if QUIRC_MAX_THREADS > 1
+/* Threads for the bands of quirc_end() beyond the first. binarize() sets
+ * func and bands, and each band from next to num_bands is taken by
+ * whichever thread gets to it first, the caller included. pending counts
+ * those which haven't finished yet.
+ */
+struct quirc_workers {
+	pthread_mutex_t		lock;
+	pthread_cond_t		wake;
+	pthread_cond_t		done;
+	pthread_t		threads[QUIRC_MAX_THREADS - 1];
+	int			num_threads;
+	int			quit;
+
+	void			(*func)(struct quirc_band *band);
+	struct quirc_band	*bands;
+	int			next;
+	int			num_bands;
+	int			pending;
+};
+#endif
+
 struct quirc_capstone {
 	int			ring;
 	int			stone;
@@ -91,6 +358,10 @@ struct quirc_grid {
 	/* Grid size and perspective transform */
 	int			grid_size;
 	quirc_float_t		c[QUIRC_PERSPECTIVE_PARAMS];
+#if QUIRC_FIXED_POINT
+	/* Sampling copy of c, kept in sync by grid_set_param() */
+	struct quirc_fixed_transform	fc;
+#endif
 };
 
 struct quirc_flood_fill_vars {
@@ -101,11 +372,40 @@ struct quirc_flood_fill_vars {
 };
 
 struct quirc {
+	/* The image being processed: image_buf, or the caller's buffer
+	 * after quirc_begin_external(). image_buf is freed by the first
+	 * quirc_begin_external() call and NULL from then on.
+	 */
 	uint8_t			*image;
+	uint8_t			*image_buf;
 	quirc_pixel_t		*pixels;
 	int			w;
 	int			h;
 
+	/* Threshold cache, see quirc_set_threshold_reuse() */
+	int			threshold_reuse;
+	int			threshold_age;
+	uint8_t			threshold;
+
+	/* Per-tile thresholds for QUIRC_THRESHOLD_TILED */
+	quirc_threshold_mode_t	threshold_mode;
+	int			tiles_x;
+	int			tiles_y;
+	uint8_t			*tile_thresholds;
+
+	/* Search area, [roi_x0, roi_x1) x [roi_y0, roi_y1). Capstone scanning
+	 * and flood fills stay inside it. See quirc_set_tracking().
+	 */
+	int			roi_x0;
+	int			roi_y0;
+	int			roi_x1;
+	int			roi_y1;
+	int			track_max_misses;
+	int			track_misses;
+	int			track_valid;
+	struct quirc_point	track_min;
+	struct quirc_point	track_max;
+
 	int			num_regions;
 	struct quirc_region	regions[QUIRC_MAX_REGIONS];
 
@@ -117,8 +417,34 @@ struct quirc {
 
 	size_t      		num_flood_fill_vars;
 	struct quirc_flood_fill_vars *flood_fill_vars;
+
+	/* Run labelling of the current image. row_runs[y] is the first run
+	 * on row y, for h + 1 rows. runs_valid is 0 when the image had too
+	 * many runs and regions are flood filled instead.
+	 */
+	struct quirc_run	*runs;
+	int32_t			*row_runs;
+	int			max_runs;
+	int			num_runs;
+	int			runs_valid;
+
+	/* Bands of the last binarization, see quirc_set_threads() */
+	int			num_threads;
+	int			num_bands;
+	struct quirc_band	bands[QUIRC_MAX_THREADS];
+#if QUIRC_MAX_THREADS > 1
+	struct quirc_workers	*workers;
+#endif
 };
 
+#if QUIRC_MAX_THREADS > 1
+/* Start count band threads for q, or none, in place of any it had.
+ * Returns the number started.
+ */
+int quirc_workers_start(struct quirc *q, int count);
+void quirc_workers_stop(struct quirc *q);
+#endif
+
 /************************************************************************
  * QR-code version information database
  */
@@ -30,6 +30,21 @@
 #define QR_TIMEOUT_MS 2000          // Timeout if no QR code detected (ms)
 #define DOCK_COMPLETE_WIDTH 90      // QR width threshold for docking complete
 
+// Latency Compensation
+#define QR_MIN_LATENCY_MS 40        // Fastest capture-to-arrival time (detection + WiFi)
+#define QR_CLOCK_WINDOW 50          // Frames per window of the camera clock offset estimate
+#define QR_MAX_EXTRAPOLATION_MS 300 // Never predict further ahead than this
+
+// QR Tracker (alpha-beta filter on center_x and width, gains in 1/256)
+#define QR_TRACK_ALPHA 128          // Position gain (0.5)
+#define QR_TRACK_BETA 32            // Rate gain (0.125)
+#define QR_TRACK_GATE_PCT 30        // Reject widths this far (% of width) from the prediction
+#define QR_TRACK_MAX_OUTLIERS 2     // Consecutive rejections that restart the track
+#define QR_TRACK_MIN_DT_MS 20       // Shortest interval a rate is estimated over (text lines come in bursts)
+#define QR_TRACK_MAX_RATE (FRAME_WIDTH * 4) // Fastest believable change, pixels per second
+#define QR_TRACK_CONFIDENCE_STEP 25 // Confidence gained per accepted measurement (max 100)
+#define QR_TRACK_MIN_CONFIDENCE 10  // Below this the marker counts as lost
+
 // QR Code Side Identification
 // Define expected QR code payloads for each side
 // These should match the actual QR codes on the passive robot
@@ -43,6 +58,48 @@
 #define ARDUINO_AP_SSID "Nano_OrbitalCleaners_AP"  // Arduino WiFi AP name (must match)
 #define ARDUINO_AP_PASSWORD "orbitalcleaner"         // Arduino WiFi AP password (must match)
 
+// Control Loop Timing
+#define CONTROL_PERIOD_US 20000UL         // navigation_update() period (50 Hz)
+#define CONTROL_SOCKET_BUDGET_US 10000UL  // Socket servicing allowed per period
+#define SCHEDULER_STATS_MS 5000           // Scheduler report interval over Serial
+
+// Acceleration Limits (power levels per second, 0 = no limit)
+// motor_update() slews each axis of the wheel command at most this fast,
+// which keeps reversal current spikes from browning out the WiFi module.
+#define ACCEL_FORWARD 20            // 0 to full forward in 0.45 s
+#define ACCEL_STRAFE 15
+#define ACCEL_YAW 30
+
+// Motion Queue (timed laptop commands, time argument 1-9)
+#define MOTION_QUEUE_LEN 16         // Timed motions that can wait in the queue
+#define MOTION_RAMP_MS 150          // Ramp-up/down time between different motions
+
+// Closed-Loop Wheel Speed (needs a pulse encoder on each wheel)
+// With SPEED_CONTROL 0 the motors are driven open loop, power mapped
+// straight to PWM. With 1, power levels become wheel speed set-points
+// held by a PI(D) loop on the SAMD21's TC5 (TC4 belongs to Servo).
+#define SPEED_CONTROL 0
+// The encoder inputs need external interrupts. On the Nano 33 IoT only
+// 2, 3, 9, 10, 11, 13, A1, A5 and A7 have one, and 2, 3, 10 and 13 drive
+// the motors while 9 drives the gripper servo.
+#define ENCODER_PIN_1 11            // Pulse input of Mot1
+#define ENCODER_PIN_2 A1            // Pulse input of Mot2
+#define ENCODER_PIN_3 A5            // Pulse input of Mot3
+#define ENCODER_PULSES_PER_REV 20   // Pulses per wheel revolution
+#define WHEEL_DIAMETER_MM 60
+#define SPEED_MAX_MM_S 400          // Wheel speed at power 9
+#define SPEED_LOOP_HZ 100           // Speed loop rate
+#define SPEED_STALL_MS 200          // No pulse for this long reads as standstill
+#define SPEED_KP 48                 // PWM per mm/s, in 1/256
+#define SPEED_KI 8                  // PWM per mm/s per loop, in 1/256
+#define SPEED_KD 0                  // PWM per mm/s change per loop, in 1/256
+
+// Bytes read per loop() from each socket, so neither can starve navigation
+#define CONTROL_RX_BUDGET 16        // Laptop commands (a movement command is 5 bytes)
+#define ESP32CAM_RX_BUDGET 64       // ESP32-CAM QR data (a binary frame is 28 bytes)
+#define ESP32CAM_RX_RING 256        // Receive ring for ESP32-CAM data (power of two)
+#define QR_LINE_MAX 128             // Text lines this long (with newline) or longer are dropped
+
 #endif
 
 
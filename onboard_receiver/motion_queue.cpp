@@ -0,0 +1,92 @@
+#include <Arduino.h>
+#include "motion_queue.h"
+#include "motor_control.h"
+
+struct Motion {
+  int8_t forward;
+  int8_t strafe;
+  int8_t yaw;
+  unsigned long duration_ms;
+};
+
+static Motion queue[MOTION_QUEUE_LEN];
+static int head = 0;
+static int count = 0;
+static bool running = false;
+static unsigned long motion_start = 0;
+static Motion previous = {0};  // Last motion run, zero after a stop
+
+static bool same_motion(const Motion &a, const Motion &b) {
+  return a.forward == b.forward && a.strafe == b.strafe && a.yaw == b.yaw;
+}
+
+bool motion_enqueue(int forward, int strafe, int yaw, unsigned long duration_ms) {
+  if (count == MOTION_QUEUE_LEN) {
+    return false;
+  }
+  Motion &m = queue[(head + count) % MOTION_QUEUE_LEN];
+  m.forward = forward;
+  m.strafe = strafe;
+  m.yaw = yaw;
+  m.duration_ms = duration_ms;
+  count++;
+  return true;
+}
+
+void motion_clear() {
+  count = 0;
+  running = false;
+  memset(&previous, 0, sizeof(previous));
+}
+
+int motion_queue_space() {
+  return MOTION_QUEUE_LEN - count;
+}
+
+// Speed of the current motion in 1/256: a linear ramp at either end,
+// skipped where the neighbouring motion is the same one, and never longer
+// than half the motion.
+static int ramp_level(const Motion &m, unsigned long elapsed) {
+  unsigned long ramp = min((unsigned long)MOTION_RAMP_MS, m.duration_ms / 2);
+  unsigned long level = 256;
+
+  if (ramp == 0) {
+    return level;
+  }
+  if (!same_motion(m, previous) && elapsed < ramp) {
+    level = elapsed * 256 / ramp;
+  }
+  bool continues = count > 1 && same_motion(m, queue[(head + 1) % MOTION_QUEUE_LEN]);
+  unsigned long left = m.duration_ms - elapsed;
+  if (!continues && left < ramp) {
+    level = min(level, left * 256 / ramp);
+  }
+  return level;
+}
+
+void motion_update(unsigned long now_ms) {
+  if (!running) {
+    if (count == 0) {
+      return;
+    }
+    running = true;
+    motion_start = now_ms;
+  }
+
+  unsigned long elapsed = now_ms - motion_start;
+  while (elapsed >= queue[head].duration_ms) {
+    previous = queue[head];
+    head = (head + 1) % MOTION_QUEUE_LEN;
+    count--;
+    // Carry the overshoot into the next motion so a burst keeps its timing
+    motion_start += previous.duration_ms;
+    elapsed = now_ms - motion_start;
+    if (count == 0) {
+      coast();
+      return;
+    }
+  }
+
+  const Motion &m = queue[head];
+  mix_motors_scaled(m.forward, m.strafe, m.yaw, ramp_level(m, elapsed));
+}
@@ -0,0 +1,23 @@
+#ifndef MOTION_QUEUE_H
+#define MOTION_QUEUE_H
+
+#include "config.h"
+
+// Queue of timed motions for manual control. Each motion is a blend of
+// the three axes of mix_motors() held for a duration, ramped up from and
+// down to standstill over MOTION_RAMP_MS, except where two queued motions
+// in a row are the same. motion_update() runs the queue from the control
+// tick, so nothing waits in delay().
+
+// Returns false, and drops the motion, when MOTION_QUEUE_LEN are waiting.
+bool motion_enqueue(int forward, int strafe, int yaw, unsigned long duration_ms);
+
+// Forget all queued motions. The motors are left as they are.
+void motion_clear();
+
+// Drive the motors for the current motion; stops them when the queue runs out.
+void motion_update(unsigned long now_ms);
+
+int motion_queue_space();
+
+#endif
@@ -1,5 +1,8 @@
 #include <Arduino.h>
+#include "config.h"
 #include "motor_control.h"
+#include "speed_control.h"
+#include "motion_queue.h"
 
 // Define motor pin constants globally in the .cpp file
 const int Mot1_pwm = 2;
@@ -15,223 +18,266 @@ const int Mot3_hbridge_2 = 13;
 int global_max_speed = 200; //maximum speed which the pwoer will be normalised to
 int time_normaliser = 500; //same here, value is in miliseconds
 
-void motor_init() {
-  pinMode(Mot1_pwm, OUTPUT);
-  pinMode(Mot2_pwm, OUTPUT);
-  pinMode(Mot3_pwm, OUTPUT);
-  pinMode(Mot1_hbridge_1, OUTPUT);
-  pinMode(Mot1_hbridge_2, OUTPUT);
-  pinMode(Mot2_hbridge_1, OUTPUT);
-  pinMode(Mot2_hbridge_2, OUTPUT);
-  pinMode(Mot3_hbridge_1, OUTPUT);
-  pinMode(Mot3_hbridge_2, OUTPUT);
-
-  digitalWrite(Mot1_hbridge_1, LOW);
-  digitalWrite(Mot1_hbridge_2, LOW);
-  digitalWrite(Mot2_hbridge_1, LOW);
-  digitalWrite(Mot2_hbridge_2, LOW);
-  digitalWrite(Mot3_hbridge_1, LOW);
-  digitalWrite(Mot3_hbridge_2, LOW);
+// Last state written to each motor, so repeated commands cost nothing.
+// dir is -1, 0 or +1 (the sign set_motor() was given); -2 forces the
+// first write after motor_init().
+struct MotorOutput {
+  int pwm_pin;
+  int hbridge_1;
+  int hbridge_2;
+  int8_t dir;
+  int pwm;
+};
+
+static MotorOutput motors[3] = {
+  { Mot1_pwm, Mot1_hbridge_1, Mot1_hbridge_2, -2, -1 },
+  { Mot2_pwm, Mot2_hbridge_1, Mot2_hbridge_2, -2, -1 },
+  { Mot3_pwm, Mot3_hbridge_1, Mot3_hbridge_2, -2, -1 },
+};
+
+#ifdef ARDUINO_ARCH_SAMD
+// All six H-bridge pins are on the SAMD21's PORTA and PORTB. Direction
+// changes are collected into one clear mask and one set mask per port and
+// written with OUTCLR then OUTSET, so every pin goes low before any goes
+// high and a bridge is never briefly driven both ways.
+static uint32_t port_clr[2];
+static uint32_t port_set[2];
+
+static void write_pin(int pin, bool high) {
+  const PinDescription &p = g_APinDescription[pin];
+  (high ? port_set : port_clr)[p.ulPort] |= 1ul << p.ulPin;
 }
 
-void go_forward(int power, int time) {
-  int desired_speed = (power * global_max_speed) / 9;
+static void flush_pins() {
+  for (int g = 0; g < 2; g++) {
+    if (port_clr[g]) PORT->Group[g].OUTCLR.reg = port_clr[g];
+    if (port_set[g]) PORT->Group[g].OUTSET.reg = port_set[g];
+    port_clr[g] = 0;
+    port_set[g] = 0;
+  }
+}
+#else
+static void write_pin(int pin, bool high) {
+  digitalWrite(pin, high ? HIGH : LOW);
+}
+
+static void flush_pins() {
+}
+#endif
 
-  digitalWrite(Mot2_hbridge_1, LOW);
-  digitalWrite(Mot2_hbridge_2, HIGH);
-  digitalWrite(Mot3_hbridge_1, HIGH);
-  digitalWrite(Mot3_hbridge_2, LOW);
+// Axis commands (forward, strafe, yaw) in 1/256 of a power level: the
+// last one asked for, and the one motor_update() has slewed the wheels to
+static long axis_target[3];
+static long axis_applied[3];
+static unsigned long last_update_us = 0;
+static const long axis_accel[3] = { ACCEL_FORWARD, ACCEL_STRAFE, ACCEL_YAW };
 
-  analogWrite(Mot2_pwm, desired_speed);
-  analogWrite(Mot3_pwm, desired_speed);
+void motor_init() {
+  for (int i = 0; i < 3; i++) {
+    pinMode(motors[i].pwm_pin, OUTPUT);
+    pinMode(motors[i].hbridge_1, OUTPUT);
+    pinMode(motors[i].hbridge_2, OUTPUT);
+    motors[i].dir = -2;
+    motors[i].pwm = -1;
+    axis_target[i] = 0;
+    axis_applied[i] = 0;
+  }
+  set_motors(0, 0, 0);
+  last_update_us = micros();
+#if SPEED_CONTROL
+  speed_control_init();
+#endif
 }
 
+// Drive the three motors at a signed PWM each: positive sets hbridge_1
+// HIGH. Only what differs from the last call is written. A motor whose
+// direction changes has its PWM cut first, then all direction pins are
+// flushed together, then the new duties are applied. With SPEED_CONTROL,
+// only the speed loop's timer interrupt calls this.
+void set_motors(long pwm1, long pwm2, long pwm3) {
+  long pwm[3] = { pwm1, pwm2, pwm3 };
+
+  for (int i = 0; i < 3; i++) {
+    MotorOutput &m = motors[i];
+    int8_t dir = pwm[i] > 0 ? 1 : (pwm[i] < 0 ? -1 : 0);
+    if (dir == m.dir) continue;
+    if (m.pwm != 0) {
+      analogWrite(m.pwm_pin, 0);
+      m.pwm = 0;
+    }
+    write_pin(m.hbridge_1, dir > 0);
+    write_pin(m.hbridge_2, dir < 0);
+    m.dir = dir;
+  }
+  flush_pins();
+
+  for (int i = 0; i < 3; i++) {
+    MotorOutput &m = motors[i];
+    int duty = labs(pwm[i]);
+    if (duty == m.pwm) continue;
+    analogWrite(m.pwm_pin, duty);
+    m.pwm = duty;
+  }
+}
+
+// Stop at once, without the ACCEL_* ramp: drop any queued motions, zero
+// the axis command and cut the wheels. This is the emergency and docking
+// stop. coast() below ramps down instead.
 void stop(){
-  analogWrite(Mot1_pwm, 0);
-  analogWrite(Mot2_pwm, 0);
-  analogWrite(Mot3_pwm, 0);
-  digitalWrite(Mot1_hbridge_1, LOW);
-  digitalWrite(Mot1_hbridge_2, LOW);
-  digitalWrite(Mot2_hbridge_1, LOW);
-  digitalWrite(Mot2_hbridge_2, LOW);
-  digitalWrite(Mot3_hbridge_1, LOW);
-  digitalWrite(Mot3_hbridge_2, LOW);
+  motion_clear();
+  for (int i = 0; i < 3; i++) {
+    axis_target[i] = 0;
+    axis_applied[i] = 0;
+  }
+#if SPEED_CONTROL
+  speed_stop();
+#else
+  set_motors(0, 0, 0);
+#endif
+}
 
+// Zero the axis command and let motor_update() ramp the wheels down
+void coast(){
+  motion_clear();
+  mix_motors(0, 0, 0);
 }
 
-void go_backward(int power, int time) {
-  int desired_speed = (power * global_max_speed) / 9;
+// The single motions are fixed blends of the mixer below. A time of 0
+// runs the motion until the next command; 1-9 queues it for that many
+// time_normaliser units behind any motions already queued.
+static void run_motion(int forward, int strafe, int yaw, int time) {
+  if (time > 0) {
+    motion_enqueue(forward, strafe, yaw, (unsigned long)time * time_normaliser);
+    return;
+  }
+  motion_clear();
+  mix_motors(forward, strafe, yaw);
+}
 
-  digitalWrite(Mot2_hbridge_1, HIGH);
-  digitalWrite(Mot2_hbridge_2, LOW);
-  digitalWrite(Mot3_hbridge_1, LOW);
-  digitalWrite(Mot3_hbridge_2, HIGH);
+void go_forward(int power, int time) {
+  run_motion(power, 0, 0, time);
+}
 
-  analogWrite(Mot2_pwm, desired_speed);
-  analogWrite(Mot3_pwm, desired_speed);
+void go_backward(int power, int time) {
+  run_motion(-power, 0, 0, time);
 }
 
 void turn_left(int power, int time){
-  int desired_speed = (power * global_max_speed) / 9;
-
-  digitalWrite(Mot1_hbridge_1, LOW);
-  digitalWrite(Mot1_hbridge_2, HIGH);
-  digitalWrite(Mot2_hbridge_1, HIGH);
-  digitalWrite(Mot2_hbridge_2, LOW);
-  digitalWrite(Mot3_hbridge_1, HIGH);
-  digitalWrite(Mot3_hbridge_2, LOW);
-
-  analogWrite(Mot1_pwm, desired_speed);
-  analogWrite(Mot2_pwm, desired_speed);
-  analogWrite(Mot3_pwm, desired_speed);
+  run_motion(0, 0, -power, time);
 }
 
 void turn_right(int power, int time){
-  int desired_speed = (power * global_max_speed) / 9;
-
-  digitalWrite(Mot1_hbridge_1, HIGH);
-  digitalWrite(Mot1_hbridge_2, LOW);
-  digitalWrite(Mot2_hbridge_1, LOW);
-  digitalWrite(Mot2_hbridge_2, HIGH);
-  digitalWrite(Mot3_hbridge_1, LOW);
-  digitalWrite(Mot3_hbridge_2, HIGH);
-
-  analogWrite(Mot1_pwm, desired_speed);
-  analogWrite(Mot2_pwm, desired_speed);
-  analogWrite(Mot3_pwm, desired_speed);
+  run_motion(0, 0, power, time);
 }
 
 void translate_right(int power, int time){
-  int desired_speed = (power * global_max_speed) / 9;
+  run_motion(0, power, 0, time);
+}
 
-  digitalWrite(Mot1_hbridge_1, LOW);
-  digitalWrite(Mot1_hbridge_2, HIGH);
-  digitalWrite(Mot2_hbridge_1, LOW);
-  digitalWrite(Mot2_hbridge_2, HIGH);
-  digitalWrite(Mot3_hbridge_1, LOW);
-  digitalWrite(Mot3_hbridge_2, HIGH);
+void translate_left(int power, int time){
+  run_motion(0, -power, 0, time);
+}
 
-  analogWrite(Mot1_pwm, desired_speed);
-  analogWrite(Mot2_pwm, desired_speed/2);
-  analogWrite(Mot3_pwm, desired_speed/2);
+// Inverse kinematics of the three-wheel base. Each input is on the 0-9
+// power scale, signed (forward, strafe right, yaw right). Per unit of
+// input, the wheels turn as in go_forward, translate_right and
+// turn_right:
+//
+//            Mot1   Mot2   Mot3
+//   forward    0     -1     +1
+//   strafe    -1    -1/2   -1/2
+//   yaw       +1     -1     -1
+//
+// so a single axis reproduces the old single-motion PWM exactly. The
+// blend only sets a target: motor_update() moves the wheels towards it.
+void mix_motors(int forward, int strafe, int yaw) {
+  mix_motors_scaled(forward, strafe, yaw, 256);
 }
 
-void translate_left(int power, int time){
-  int desired_speed = (power * global_max_speed) / 9;
+// As mix_motors(), with the result scaled by level/256 (used for ramps)
+void mix_motors_scaled(int forward, int strafe, int yaw, int level) {
+  axis_target[0] = (long)forward * level;
+  axis_target[1] = (long)strafe * level;
+  axis_target[2] = (long)yaw * level;
+}
 
-  digitalWrite(Mot1_hbridge_1, HIGH);
-  digitalWrite(Mot1_hbridge_2, LOW);
-  digitalWrite(Mot2_hbridge_1, HIGH);
-  digitalWrite(Mot2_hbridge_2, LOW);
-  digitalWrite(Mot3_hbridge_1, HIGH);
-  digitalWrite(Mot3_hbridge_2, LOW);
+// Turn axis commands in 1/256 power into wheel outputs. When the blend
+// asks a wheel for more than full power, all three are scaled down by the
+// same factor, which keeps the direction of travel. With SPEED_CONTROL,
+// the result becomes wheel speed set-points instead of PWM.
+static void drive_wheels(const long *axis) {
+  long forward = axis[0], strafe = axis[1], yaw = axis[2];
+
+  // Doubled so the half-speed strafe terms stay integers
+  long m1 = -2L * strafe + 2L * yaw;
+  long m2 = -2L * forward - strafe - 2L * yaw;
+  long m3 = 2L * forward - strafe - 2L * yaw;
+  long full = 2L * 9 * 256;
+
+  long peak = max(labs(m1), max(labs(m2), labs(m3)));
+  if (peak > full) {
+    m1 = m1 * full / peak;
+    m2 = m2 * full / peak;
+    m3 = m3 * full / peak;
+  }
 
-  analogWrite(Mot1_pwm, desired_speed);
-  analogWrite(Mot2_pwm, desired_speed/2);
-  analogWrite(Mot3_pwm, desired_speed/2);
+#if SPEED_CONTROL
+  speed_set_targets(m1 * SPEED_MAX_MM_S / full,
+                    m2 * SPEED_MAX_MM_S / full,
+                    m3 * SPEED_MAX_MM_S / full);
+#else
+  set_motors(m1 * global_max_speed / full,
+             m2 * global_max_speed / full,
+             m3 * global_max_speed / full);
+#endif
 }
 
-// Smooth movement functions for proportional control
-void move_forward_smooth(int speed) {
-  int desired_speed = (speed * global_max_speed) / 9;
-  if (desired_speed < 0) desired_speed = 0;
-  if (desired_speed > global_max_speed) desired_speed = global_max_speed;
+// Move each axis towards its target by at most its ACCEL_* limit for the
+// time since the last call, then drive the wheels. Reversals pass through
+// zero at the same rate, so the H-bridges never jump from full reverse to
+// full forward. An accel limit of 0 applies the target at once.
+void motor_update() {
+  unsigned long now = micros();
+  unsigned long dt = now - last_update_us;
+  last_update_us = now;
+  if (dt > 100000UL) {
+    // After a stall, don't let the whole gap through in one step
+    dt = 100000UL;
+  }
 
-  digitalWrite(Mot2_hbridge_1, LOW);
-  digitalWrite(Mot2_hbridge_2, HIGH);
-  digitalWrite(Mot3_hbridge_1, HIGH);
-  digitalWrite(Mot3_hbridge_2, LOW);
+  for (int i = 0; i < 3; i++) {
+    long error = axis_target[i] - axis_applied[i];
+    long step = axis_accel[i] * 256L * (long)dt / 1000000L;
+    if (axis_accel[i] == 0 || labs(error) <= step) {
+      axis_applied[i] = axis_target[i];
+    } else {
+      axis_applied[i] += error > 0 ? step : -step;
+    }
+  }
+  drive_wheels(axis_applied);
+}
 
-  analogWrite(Mot2_pwm, desired_speed);
-  analogWrite(Mot3_pwm, desired_speed);
+// Smooth movement functions for proportional control
+void move_forward_smooth(int speed) {
+  mix_motors(constrain(speed, 0, 9), 0, 0);
 }
 
 void move_backward_smooth(int speed) {
-  int desired_speed = (speed * global_max_speed) / 9;
-  if (desired_speed < 0) desired_speed = 0;
-  if (desired_speed > global_max_speed) desired_speed = global_max_speed;
-
-  digitalWrite(Mot2_hbridge_1, HIGH);
-  digitalWrite(Mot2_hbridge_2, LOW);
-  digitalWrite(Mot3_hbridge_1, LOW);
-  digitalWrite(Mot3_hbridge_2, HIGH);
-
-  analogWrite(Mot2_pwm, desired_speed);
-  analogWrite(Mot3_pwm, desired_speed);
+  mix_motors(-constrain(speed, 0, 9), 0, 0);
 }
 
 void rotate_smooth(int speed) {
   // Positive speed = rotate right, negative = rotate left
-  int desired_speed = (abs(speed) * global_max_speed) / 9;
-  if (desired_speed > global_max_speed) desired_speed = global_max_speed;
-
-  if (speed > 0) {
-    // Rotate right
-    digitalWrite(Mot1_hbridge_1, HIGH);
-    digitalWrite(Mot1_hbridge_2, LOW);
-    digitalWrite(Mot2_hbridge_1, LOW);
-    digitalWrite(Mot2_hbridge_2, HIGH);
-    digitalWrite(Mot3_hbridge_1, LOW);
-    digitalWrite(Mot3_hbridge_2, HIGH);
-  } else {
-    // Rotate left
-    digitalWrite(Mot1_hbridge_1, LOW);
-    digitalWrite(Mot1_hbridge_2, HIGH);
-    digitalWrite(Mot2_hbridge_1, HIGH);
-    digitalWrite(Mot2_hbridge_2, LOW);
-    digitalWrite(Mot3_hbridge_1, HIGH);
-    digitalWrite(Mot3_hbridge_2, LOW);
-  }
-
-  analogWrite(Mot1_pwm, desired_speed);
-  analogWrite(Mot2_pwm, desired_speed);
-  analogWrite(Mot3_pwm, desired_speed);
+  mix_motors(0, 0, constrain(speed, -9, 9));
 }
 
 void translate_smooth(int speed) {
   // Positive speed = translate right, negative = translate left
-  int desired_speed = (abs(speed) * global_max_speed) / 9;
-  if (desired_speed > global_max_speed) desired_speed = global_max_speed;
-
-  if (speed > 0) {
-    // Translate right
-    digitalWrite(Mot1_hbridge_1, LOW);
-    digitalWrite(Mot1_hbridge_2, HIGH);
-    digitalWrite(Mot2_hbridge_1, LOW);
-    digitalWrite(Mot2_hbridge_2, HIGH);
-    digitalWrite(Mot3_hbridge_1, LOW);
-    digitalWrite(Mot3_hbridge_2, HIGH);
-  } else {
-    // Translate left
-    digitalWrite(Mot1_hbridge_1, HIGH);
-    digitalWrite(Mot1_hbridge_2, LOW);
-    digitalWrite(Mot2_hbridge_1, HIGH);
-    digitalWrite(Mot2_hbridge_2, LOW);
-    digitalWrite(Mot3_hbridge_1, HIGH);
-    digitalWrite(Mot3_hbridge_2, LOW);
-  }
-
-  analogWrite(Mot1_pwm, desired_speed);
-  analogWrite(Mot2_pwm, desired_speed / 2);
-  analogWrite(Mot3_pwm, desired_speed / 2);
+  mix_motors(0, constrain(speed, -9, 9), 0);
 }
 
 void apply_motor_control(int forward, int rotation, int translate) {
-  // Apply combined motor control based on forward, rotation, and translation components
-  // This is a simplified version - for more complex control, you'd need to combine vectors
-  
-  // Priority: rotation > translation > forward
-  if (abs(rotation) > 1) {
-    rotate_smooth(rotation);
-  } else if (abs(translate) > 1) {
-    translate_smooth(translate);
-  } else if (abs(forward) > 1) {
-    if (forward > 0) {
-      move_forward_smooth(forward);
-    } else {
-      move_backward_smooth(-forward);
-    }
-  } else {
-    stop();
-  }
+  // Blend forward, rotation and translation into one wheel command, so the
+  // robot can correct its heading and offset while it advances
+  mix_motors(forward, translate, rotation);
 }
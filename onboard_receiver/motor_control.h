@@ -1,8 +1,13 @@
 #ifndef MOTORCONTROL_H
 #define MOTORCONTROL_H
 
+extern int global_max_speed;
+extern int time_normaliser; // ms per unit of a command's time argument
+
 void motor_init();
-void stop();
+void stop();  // immediate, also clears queued motions
+void coast(); // ramp down to a standstill at the ACCEL_* limits
+// time 0 runs until the next command, 1-9 queues a timed motion
 void go_forward(int speed, int time);
 void go_backward(int speed, int time);
 void turn_right(int power, int time);
@@ -16,5 +21,9 @@ void move_backward_smooth(int speed);
 void rotate_smooth(int speed); // positive = right, negative = left
 void translate_smooth(int speed); // positive = right, negative = left
 void apply_motor_control(int forward, int rotation, int translate);
+void mix_motors(int forward, int strafe, int yaw); // signed 0-9 power per axis
+void mix_motors_scaled(int forward, int strafe, int yaw, int level); // level in 1/256
+void motor_update(); // slew the wheels towards the last command, once per control tick
+void set_motors(long pwm1, long pwm2, long pwm3); // raw signed PWM per motor
 
 #endif
@@ -6,11 +6,31 @@
 
 // Global state
 static NavigationState current_state = STATE_SEARCHING;
-static QRData current_qr = {0};
-static unsigned long last_qr_update = 0;
+// One entry per marker side, so markers seen in the same frames don't
+// overwrite each other. QR_SIDE_UNKNOWN collects unrecognised payloads.
+struct Marker {
+  QRData measured;                  // Latest measurement as received
+  QRData estimate;                  // Filtered estimate at the current tick
+  QrTrack track;                    // Filter state for center_x and width
+};
+static Marker markers[QR_SIDE_COUNT];
+static uint8_t dock_side = QR_SIDE_UNKNOWN; // Side is_correct_docking_side() accepts
+static QRData current_qr = {0};     // Docking side's estimate, used for control
+
+// Camera clock offset estimate, see camera_to_local()
+static bool clock_valid = false;
+static uint32_t last_camera_ms = 0;
+static long window_min_delay = 0;
+static long prev_window_min_delay = 0;
+static int window_count = 0;
 static unsigned long state_start_time = 0;
 
 // Forward declarations for internal functions
+void update_qr(const char* id, uint8_t side, int cx, int cy, int width, int height,
+               unsigned long capture_time);
+unsigned long camera_to_local(uint32_t camera_ms, unsigned long arrival_ms);
+void predict_markers(unsigned long now);
+int best_other_marker();
 void execute_search();
 void execute_target_found();
 void execute_approaching();
@@ -21,23 +41,39 @@ void calculate_movement(int& forward_speed, int& rotation_speed, int& translate_
 void navigation_init() {
   current_state = STATE_SEARCHING;
   memset(&current_qr, 0, sizeof(QRData));
+  memset(markers, 0, sizeof(markers));
   current_qr.valid = false;
-  last_qr_update = 0;
+  dock_side = QR_SIDE_UNKNOWN;
+  for (int i = 0; i < QR_SIDE_COUNT; i++) {
+    qr_track_reset(markers[i].track);
+    if (dock_side == QR_SIDE_UNKNOWN && i != QR_SIDE_UNKNOWN &&
+        is_correct_docking_side(qr_side_name(i))) {
+      dock_side = i;
+    }
+  }
   state_start_time = millis();
 }
 
 void navigation_update() {
   unsigned long current_time = millis();
   
-  // Check if QR data is stale (timeout)
-  if (current_qr.valid && (current_time - last_qr_update > QR_TIMEOUT_MS)) {
-    current_qr.valid = false;
-    if (current_state != STATE_SEARCHING && current_state != STATE_DOCKED) {
-      current_state = STATE_LOST;
-      state_start_time = current_time;
+  // Check if QR data is stale (timeout), marker by marker
+  for (int i = 0; i < QR_SIDE_COUNT; i++) {
+    QRData& m = markers[i].measured;
+    if (m.valid && (current_time - m.timestamp > QR_TIMEOUT_MS)) {
+      m.valid = false;
+      if (i == dock_side && current_state != STATE_SEARCHING &&
+          current_state != STATE_DOCKED) {
+        current_state = STATE_LOST;
+        state_start_time = current_time;
+      }
     }
   }
   
+  // Act on the filtered estimate of where each marker is now, not on the
+  // raw measurement from when the frame was captured
+  predict_markers(current_time);
+
   // State machine execution
   switch (current_state) {
     case STATE_SEARCHING:
@@ -67,9 +103,38 @@ void navigation_update() {
   }
 }
 
-void process_qr_data(const char* data) {
-  // Parse format: QR:<id>,<cx>,<cy>,<width>,<height>\n
-  if (strncmp(data, "QR:", 3) != 0) {
+// Parse an optionally negative decimal number at ptr, stopping at end.
+// Returns false if there are no digits.
+static bool parse_number(const char*& ptr, const char* end, int& value) {
+  bool negative = false;
+  if (ptr < end && *ptr == '-') {
+    negative = true;
+    ptr++;
+  }
+  const char* digits = ptr;
+  value = 0;
+  while (ptr < end && *ptr >= '0' && *ptr <= '9') {
+    value = value * 10 + (*ptr - '0');
+    ptr++;
+  }
+  if (negative) value = -value;
+  return ptr != digits;
+}
+
+// Parse a field followed by a comma
+static bool parse_field(const char*& ptr, const char* end, int& value) {
+  if (!parse_number(ptr, end, value) || ptr >= end || *ptr != ',') {
+    return false;
+  }
+  ptr++;
+  return true;
+}
+
+void process_qr_data(const char* data, int len) {
+  // Parse format: QR:<id>,<cx>,<cy>,<width>,<height>
+  // The line is not NUL-terminated: it may sit in the receive ring.
+  const char* end = data + len;
+  if (len < 3 || strncmp(data, "QR:", 3) != 0) {
     return; // Not a QR data line
   }
   
@@ -80,75 +145,166 @@ void process_qr_data(const char* data) {
   int cx = 0, cy = 0, width = 0, height = 0;
   
   // Extract ID (until first comma)
-  while (*ptr != ',' && *ptr != '\0' && *ptr != '\n' && id_len < 31) {
+  while (ptr < end && *ptr != ',' && id_len < 31) {
     id[id_len++] = *ptr++;
   }
   id[id_len] = '\0';
   
-  if (*ptr != ',') return; // Invalid format
+  if (ptr >= end || *ptr != ',') return; // Invalid format
   ptr++; // Skip comma
   
-  // Parse cx
-  cx = 0;
-  bool negative = false;
-  if (*ptr == '-') {
-    negative = true;
-    ptr++;
-  }
-  while (*ptr >= '0' && *ptr <= '9') {
-    cx = cx * 10 + (*ptr - '0');
-    ptr++;
+  if (!parse_field(ptr, end, cx) || !parse_field(ptr, end, cy) ||
+      !parse_field(ptr, end, width)) {
+    return;
   }
-  if (negative) cx = -cx;
+  parse_number(ptr, end, height);
   
-  if (*ptr != ',') return;
-  ptr++;
-  
-  // Parse cy
-  cy = 0;
-  negative = false;
-  if (*ptr == '-') {
-    negative = true;
-    ptr++;
+  // The text format carries no capture time, so assume no latency
+  if (id_len > 0) {
+    update_qr(id, qr_side_from_id(id), cx, cy, width, height, millis());
   }
-  while (*ptr >= '0' && *ptr <= '9') {
-    cy = cy * 10 + (*ptr - '0');
-    ptr++;
+}
+
+// Integer square root, to avoid pulling in soft-float sqrt on the SAMD21
+static int isqrt(long v) {
+  long r = 0;
+  long bit = 1L << 30;
+  while (bit > v) bit >>= 2;
+  while (bit) {
+    if (v >= r + bit) {
+      v -= r + bit;
+      r = (r >> 1) + bit;
+    } else {
+      r >>= 1;
+    }
+    bit >>= 2;
   }
-  if (negative) cy = -cy;
-  
-  if (*ptr != ',') return;
-  ptr++;
-  
-  // Parse width
-  width = 0;
-  while (*ptr >= '0' && *ptr <= '9') {
-    width = width * 10 + (*ptr - '0');
-    ptr++;
+  return (int)r;
+}
+
+static int corner_dist(const QrFrame& f, int a, int b) {
+  long dx = f.corner_x[b] - f.corner_x[a];
+  long dy = f.corner_y[b] - f.corner_y[a];
+  return isqrt(dx * dx + dy * dy);
+}
+
+void process_qr_frame(const QrFrame& frame) {
+  if (frame.side == QR_SIDE_UNKNOWN || frame.side >= QR_SIDE_COUNT) {
+    return;
   }
-  
-  if (*ptr != ',') return;
-  ptr++;
-  
-  // Parse height
-  height = 0;
-  while (*ptr >= '0' && *ptr <= '9' && *ptr != '\0' && *ptr != '\n') {
-    height = height * 10 + (*ptr - '0');
-    ptr++;
+
+  // Same derived values the ESP32-CAM puts in the text format
+  int cx = 0, cy = 0;
+  for (int k = 0; k < 4; k++) {
+    cx += frame.corner_x[k];
+    cy += frame.corner_y[k];
   }
-  
+  cx >>= 2;
+  cy >>= 2;
+
+  update_qr(qr_side_name(frame.side), frame.side, cx, cy,
+            corner_dist(frame, 0, 1), corner_dist(frame, 1, 2),
+            camera_to_local(frame.timestamp_ms, millis()));
+}
+
+// Convert a camera capture time to the local clock. The smallest
+// arrival - capture difference seen recently is taken to be
+// QR_MIN_LATENCY_MS plus the clock offset; the minimum is kept over the
+// current and previous window of QR_CLOCK_WINDOW frames, so the estimate
+// follows clock drift and recovers from a camera reboot.
+unsigned long camera_to_local(uint32_t camera_ms, unsigned long arrival_ms) {
+  long delay = (long)(arrival_ms - camera_ms);
+
+  if (!clock_valid || camera_ms < last_camera_ms) {
+    // First frame, or the camera restarted its clock
+    window_min_delay = delay;
+    prev_window_min_delay = delay;
+    window_count = 0;
+    clock_valid = true;
+  }
+  last_camera_ms = camera_ms;
+
+  if (delay < window_min_delay) {
+    window_min_delay = delay;
+  }
+  long offset = window_min_delay < prev_window_min_delay ?
+                window_min_delay : prev_window_min_delay;
+
+  if (++window_count >= QR_CLOCK_WINDOW) {
+    prev_window_min_delay = window_min_delay;
+    window_min_delay = delay;
+    window_count = 0;
+  }
+
+  return camera_ms + offset - QR_MIN_LATENCY_MS;
+}
+
+void update_qr(const char* id, uint8_t side, int cx, int cy, int width, int height,
+               unsigned long capture_time) {
+  if (side >= QR_SIDE_COUNT) {
+    return;
+  }
+
   // Validate QR code dimensions
-  if (width >= QR_TARGET_WIDTH_MIN && width <= QR_TARGET_WIDTH_MAX && id_len > 0) {
-    strncpy(current_qr.id, id, sizeof(current_qr.id) - 1);
-    current_qr.id[sizeof(current_qr.id) - 1] = '\0';
-    current_qr.center_x = cx;
-    current_qr.center_y = cy;
-    current_qr.width = width;
-    current_qr.height = height;
-    current_qr.valid = true;
-    current_qr.timestamp = millis();
-    last_qr_update = millis();
+  if (width >= QR_TARGET_WIDTH_MIN && width <= QR_TARGET_WIDTH_MAX) {
+    Marker& marker = markers[side];
+    qr_track_update(marker.track, side, cx, width, capture_time);
+
+    QRData& m = marker.measured;
+    strncpy(m.id, id, sizeof(m.id) - 1);
+    m.id[sizeof(m.id) - 1] = '\0';
+    m.center_x = cx;
+    m.center_y = cy;
+    m.width = width;
+    m.height = height;
+    m.side = side;
+    m.valid = true;
+    m.timestamp = millis();
+    m.capture_time = capture_time;
+  }
+}
+
+// Build each marker's control estimate for now from its tracker. Between
+// frames, and through dropped ones, the tracker extrapolates; a marker
+// only counts as lost once its confidence has decayed.
+void predict_markers(unsigned long now) {
+  for (int i = 0; i < QR_SIDE_COUNT; i++) {
+    Marker& marker = markers[i];
+    QRData& e = marker.estimate;
+
+    e = marker.measured;
+    if (!e.valid) {
+      e.confidence = 0;
+      continue;
+    }
+    e.confidence = qr_track_predict(marker.track, now, e.center_x, e.width);
+    if (e.confidence < QR_TRACK_MIN_CONFIDENCE) {
+      e.valid = false;
+    }
   }
+
+  if (dock_side != QR_SIDE_UNKNOWN) {
+    current_qr = markers[dock_side].estimate;
+  } else {
+    current_qr.valid = false;
+  }
+}
+
+// The most confident visible marker other than the docking side, or -1.
+// Ties go to the lowest side ID, so the choice doesn't depend on which
+// frame arrived last.
+int best_other_marker() {
+  int best = -1;
+  for (int i = QR_SIDE_UNKNOWN + 1; i < QR_SIDE_COUNT; i++) {
+    const QRData& e = markers[i].estimate;
+    if (i == dock_side || !e.valid) {
+      continue;
+    }
+    if (best < 0 || e.confidence > markers[best].estimate.confidence) {
+      best = i;
+    }
+  }
+  return best;
 }
 
 bool is_correct_docking_side(const char* qr_id) {
@@ -170,23 +326,64 @@ QRData get_current_qr_data() {
   return current_qr;
 }
 
+QRData get_marker_data(uint8_t side) {
+  if (side >= QR_SIDE_COUNT) {
+    QRData none = {0};
+    return none;
+  }
+  return markers[side].estimate;
+}
+
 // State execution functions
 
+// Which way to strafe, -1 left or +1 right, to circle the passive robot
+// from the face we see towards its docking face. On the target's LEFT
+// face its FRONT is to our left; on its RIGHT face, to our right. From
+// the BACK both ways are as long, and we go left.
+static int circle_direction(uint8_t side) {
+  // Faces in clockwise order around the target, seen from above. Going
+  // clockwise round it means strafing to our left.
+  static const uint8_t ring[4] = {
+    QR_SIDE_ID_FRONT, QR_SIDE_ID_RIGHT, QR_SIDE_ID_BACK, QR_SIDE_ID_LEFT
+  };
+  int from = 0, to = 0;
+  for (int k = 0; k < 4; k++) {
+    if (ring[k] == side) from = k;
+    if (ring[k] == dock_side) to = k;
+  }
+  int clockwise_steps = (to - from + 4) % 4;
+  return clockwise_steps == 3 ? 1 : -1;
+}
+
 void execute_search() {
-  // Rotate to find QR code
   if (current_qr.valid) {
-    // QR code detected, check if it's the correct side
+    // Docking side in view
     current_state = STATE_TARGET_FOUND;
     state_start_time = millis();
     stop();
-  } else {
-    // Continue rotating
-    turn_left(SEARCH_ROTATION_SPEED, 1);
+    return;
+  }
+
+  int other = best_other_marker();
+  if (other >= 0) {
+    // Another side in view: circle the target towards the docking side,
+    // turning to keep the marker centred
+    int x_offset = markers[other].estimate.center_x - FRAME_CENTER_X;
+    int rotation_speed = 0;
+    if (abs(x_offset) > QR_CENTER_TOLERANCE) {
+      rotation_speed = x_offset > 0 ? ALIGN_SPEED : -ALIGN_SPEED;
+    }
+    apply_motor_control(0, rotation_speed,
+                        circle_direction(other) * SEARCH_ROTATION_SPEED);
+    return;
   }
+
+  // Nothing in view, continue rotating
+  turn_left(SEARCH_ROTATION_SPEED, 0);
 }
 
 void execute_target_found() {
-  // Check if this is the correct docking side
+  // current_qr only ever holds the docking side's marker
   if (!current_qr.valid) {
     current_state = STATE_SEARCHING;
     state_start_time = millis();
@@ -225,23 +422,10 @@ void execute_approaching() {
   
   calculate_movement(forward_speed, rotation_speed, translate_speed);
   
-  // Apply movement
-  if (abs(rotation_speed) > 1) {
-    if (rotation_speed > 0) {
-      turn_right(APPROACH_SPEED, 1);
-    } else {
-      turn_left(APPROACH_SPEED, 1);
-    }
-  } else if (abs(translate_speed) > 1) {
-    if (translate_speed > 0) {
-      translate_right(APPROACH_SPEED, 1);
-    } else {
-      translate_left(APPROACH_SPEED, 1);
-    }
-  } else {
-    // Move forward
-    go_forward(APPROACH_SPEED, 1);
-  }
+  // Advance while correcting heading and offset in the same command
+  apply_motor_control(APPROACH_SPEED,
+                      constrain(rotation_speed, -APPROACH_SPEED, APPROACH_SPEED),
+                      constrain(translate_speed, -APPROACH_SPEED, APPROACH_SPEED));
 }
 
 void execute_aligning() {
@@ -272,28 +456,10 @@ void execute_aligning() {
   
   calculate_movement(forward_speed, rotation_speed, translate_speed);
   
-  // Apply fine movements
-  if (abs(rotation_speed) > 0) {
-    if (rotation_speed > 0) {
-      turn_right(ALIGN_SPEED, 1);
-    } else {
-      turn_left(ALIGN_SPEED, 1);
-    }
-  } else if (abs(translate_speed) > 0) {
-    if (translate_speed > 0) {
-      translate_right(ALIGN_SPEED, 1);
-    } else {
-      translate_left(ALIGN_SPEED, 1);
-    }
-  } else if (abs(forward_speed) > 0) {
-    if (forward_speed > 0) {
-      go_forward(ALIGN_SPEED, 1);
-    } else {
-      go_backward(ALIGN_SPEED, 1);
-    }
-  } else {
-    stop();
-  }
+  // Apply fine movements on all axes at once
+  apply_motor_control(constrain(forward_speed, -ALIGN_SPEED, ALIGN_SPEED),
+                      constrain(rotation_speed, -ALIGN_SPEED, ALIGN_SPEED),
+                      constrain(translate_speed, -ALIGN_SPEED, ALIGN_SPEED));
 }
 
 void execute_docking() {
@@ -315,15 +481,11 @@ void execute_docking() {
   int x_offset = current_qr.center_x - FRAME_CENTER_X;
   
   // Small corrections while moving forward
+  int translate_speed = 0;
   if (abs(x_offset) > QR_CENTER_TOLERANCE) {
-    if (x_offset > 0) {
-      translate_right(ALIGN_SPEED, 1);
-    } else {
-      translate_left(ALIGN_SPEED, 1);
-    }
-  } else {
-    go_forward(DOCK_SPEED, 1);
+    translate_speed = x_offset > 0 ? ALIGN_SPEED : -ALIGN_SPEED;
   }
+  apply_motor_control(DOCK_SPEED, 0, translate_speed);
 }
 
 void calculate_movement(int& forward_speed, int& rotation_speed, int& translate_speed) {
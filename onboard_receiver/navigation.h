@@ -2,6 +2,8 @@
 #define NAVIGATION_H
 
 #include "config.h"
+#include "qr_protocol.h"
+#include "qr_tracker.h"
 
 // Navigation State Machine States
 enum NavigationState {
@@ -21,17 +23,22 @@ struct QRData {
   int center_y;         // Center Y coordinate in frame
   int width;            // QR code width in pixels
   int height;           // QR code height in pixels
+  uint8_t side;         // QrSide matching id, QR_SIDE_UNKNOWN otherwise
   bool valid;           // Whether data is valid
   unsigned long timestamp; // Last update timestamp
+  unsigned long capture_time; // Estimated frame capture time (local millis())
+  uint8_t confidence;   // Tracker confidence 0-100 (filtered estimate only)
 };
 
 // Navigation Functions
 void navigation_init();
 void navigation_update();
-void process_qr_data(const char* data);
+void process_qr_data(const char* data, int len);
+void process_qr_frame(const QrFrame& frame);
 bool is_correct_docking_side(const char* qr_id);
 NavigationState get_navigation_state();
-QRData get_current_qr_data();
+QRData get_current_qr_data();   // Docking side
+QRData get_marker_data(uint8_t side); // Any QrSide, filtered estimate
 
 #endif
 
@@ -4,6 +4,9 @@
 #include "motor_control.h"
 #include "student_functions.h"
 #include "navigation.h"
+#include "scheduler.h"
+#include "motion_queue.h"
+#include "rx_ring.h"
 #include "config.h"
 
 char ssid[] = "Nano_OrbitalCleaners_AP";
@@ -15,11 +18,29 @@ WiFiServer esp32cam_server(8081);  // TCP server on port 8081 for ESP32-CAM
 
 // Autonomous navigation mode
 bool autonomous_mode = false;  // Set to true to enable autonomous docking
-String qr_data_buffer = "";    // Buffer for reading QR data from ESP32-CAM
+RxRing esp32cam_rx;            // Data from the ESP32-CAM, not yet parsed
+uint8_t qr_scratch[QR_LINE_MAX]; // Copy of a message that wraps around esp32cam_rx
+unsigned long qr_frame_errors = 0; // Binary frames dropped on sync/CRC errors
+unsigned long qr_line_overflows = 0; // Text lines dropped for being too long
 WiFiClient esp32cam_client;   // Client connection from ESP32-CAM
+WiFiClient control_client;    // Client connection from the laptop
+
+// Laptop command parser state, kept across loop() calls
+struct CommandParser {
+  char cmd;                   // Movement command waiting for arguments, 0 if none
+  uint8_t nargs;              // Argument bytes received so far
+  char args[4];               // ' ', power, ' ', time
+};
+CommandParser control_parser = {0};
 
 // Forward declaration
 void read_esp32cam_data();
+void scan_esp32cam_data();
+void service_control_client();
+void print_scheduler_stats();
+void parse_control_byte(CommandParser& parser, char c);
+void execute_command(char c, char power, char time);
+void print_motion(const char* what, char power, char time);
 
 void setup() { 
   Serial.begin(9600); //initialising serial connection for debugging
@@ -49,231 +70,326 @@ void setup() {
 
   motor_init();
   navigation_init();
+  scheduler_init();
   
   Serial.println("System initialized. Press 'm' to toggle autonomous mode.");
   Serial.println("Autonomous mode: OFF");
 }
 
 void loop() {
+  // Update navigation if in autonomous mode, at a fixed rate
+  if (scheduler_tick_due()) {
+    if (autonomous_mode) {
+      navigation_update();
+    } else {
+      motion_update(millis());
+    }
+    motor_update();
+    scheduler_tick_done();
+  }
+
   // Check for ESP32-CAM connection
   if (!esp32cam_client || !esp32cam_client.connected()) {
     esp32cam_client = esp32cam_server.available();
     if (esp32cam_client) {
       Serial.println("ESP32-CAM connected!");
+      rx_ring_reset(esp32cam_rx);
     }
   }
   
   // Read data from ESP32-CAM via WiFi
   read_esp32cam_data();
   
-  // Update navigation if in autonomous mode
-  if (autonomous_mode) {
-    navigation_update();
+  // Serve the laptop without blocking the tasks above
+  service_control_client();
+
+  print_scheduler_stats();
+}
+
+void print_scheduler_stats() {
+  static unsigned long last_report = 0;
+
+  if (millis() - last_report < SCHEDULER_STATS_MS) {
+    return;
   }
-  
-  WiFiClient client = server.available(); // Listen for incoming clients
+  last_report = millis();
+
+  SchedulerStats st = scheduler_take_stats();
+  Serial.print("Sched: ticks=");
+  Serial.print(st.ticks);
+  Serial.print(" overruns=");
+  Serial.print(st.overruns);
+  Serial.print(" max_jitter_us=");
+  Serial.print(st.max_jitter_us);
+  Serial.print(" max_tick_us=");
+  Serial.print(st.max_tick_us);
+  Serial.print(" socket_cutoffs=");
+  Serial.println(st.socket_cutoffs);
+
+  Serial.print("QR link: frame_errors=");
+  Serial.print(qr_frame_errors);
+  Serial.print(" line_overflows=");
+  Serial.println(qr_line_overflows);
+}
 
-  if (client) {
+// Accept a laptop client and feed at most CONTROL_RX_BUDGET of its bytes
+// to the command parser. Returns straight away when nothing is waiting,
+// so docking keeps running while an operator is connected.
+void service_control_client() {
+  if (!control_client || !control_client.connected()) {
+    if (control_client) {
+      control_client.stop();
+      Serial.println("Client disconnected.");
+    }
+    control_client = server.available(); // Listen for incoming clients
+    if (!control_client) {
+      return;
+    }
     Serial.println("New client connected.");
-    while (client.connected()) {
-      if (client.available()) {
-        char c = client.read();
-        Serial.write(c);         // Print to serial monitor
-
-        // Toggle autonomous mode
-        if (c == 'm') {
-          autonomous_mode = !autonomous_mode;
-          if (autonomous_mode) {
-            Serial.println("Autonomous mode: ON");
-            navigation_init();
-          } else {
-            Serial.println("Autonomous mode: OFF");
-            stop();
-          }
-          client.write(c); // Echo back
-          continue;
-        }
-        
-        // If in autonomous mode, ignore manual commands (except 'm' and 's')
-        if (autonomous_mode && c != 's') {
-          client.write(c); // Echo back
-          continue;
-        }
-
-        //checking if one of standard commands
-        if (c == 's') {
-          //STOP
-          // call the stop function here
-          stop();
-          Serial.println("Motors Stopped");
-        }
-        if (c == 'f') {
-          //MOVE FORWARD
-          //expecting a format of '[power (0-9)] [time (0-9)]'
-          char space1 = client.read(); //empty space read
-          char power = client.read();
-          char space2 = client.read(); //empty space read
-          char time = client.read();
-
-          String outputmessage = "Going forward at power and time: ";
-          outputmessage += power;
-          outputmessage += ' ';
-          outputmessage += time;
-          Serial.println(outputmessage);
-
-          //converting the chars to ints
-          int itime = time - '0';
-          int ipower = power - '0';
-
-          go_forward(ipower, itime);
-        }
-
-        if (c == 'b') {
-          //MOVE BACKWARDS
-          //expecting a format of '[power (0-9)] [time (0-9)]'
-          char space1 = client.read(); //empty space read
-          char power = client.read();
-          char space2 = client.read(); //empty space read
-          char time = client.read();
-
-          String outputmessage = "Going backwards at power and time: ";
-          outputmessage += power;
-          outputmessage += ' ';
-          outputmessage += time;
-          Serial.println(outputmessage);
-
-          //converting the chars to ints
-          int itime = time - '0';
-          int ipower = power - '0';
-
-          go_backward(ipower, itime);
-        }
-
-        if (c == 'l') {
-          //ROTATE LEFT
-          //expecting a format of '[power (0-9)] [time (0-9)]'
-          char space1 = client.read(); //empty space read
-          char power = client.read();
-          char space2 = client.read(); //empty space read
-          char time = client.read();
-
-          String outputmessage = "Rotating left at power and time: ";
-          outputmessage += power;
-          outputmessage += ' ';
-          outputmessage += time;
-          Serial.println(outputmessage);
-
-          //converting the chars to ints
-          int itime = time - '0';
-          int ipower = power - '0';
-
-          turn_left(ipower, itime);
-        }
-
-        if (c == 'r') {
-          //ROTATE RIGHT
-          //expecting a format of '[power (0-9)] [time (0-9)]'
-          char space1 = client.read(); //empty space read
-          char power = client.read();
-          char space2 = client.read(); //empty space read
-          char time = client.read();
-
-          String outputmessage = "Rotating right at power and time: ";
-          outputmessage += power;
-          outputmessage += ' ';
-          outputmessage += time;
-          Serial.println(outputmessage);
-
-          //converting the chars to ints
-          int itime = time - '0';
-          int ipower = power - '0';
-
-          turn_right(ipower, itime);
-        }
-
-        if (c == 'a') {
-          //TRANSLATE LEFT
-          //expecting a format of '[power (0-9)] [time (0-9)]'
-          char space1 = client.read(); //empty space read
-          char power = client.read();
-          char space2 = client.read(); //empty space read
-          char time = client.read();
-
-          String outputmessage = "Going left at power and time: ";
-          outputmessage += power;
-          outputmessage += ' ';
-          outputmessage += time;
-          Serial.println(outputmessage);
-
-          //converting the chars to ints
-          int itime = time - '0';
-          int ipower = power - '0';
-
-          translate_left(ipower, itime);
-        }
-
-        if (c == 'd') {
-          //TRANSLATE RIGHT
-          //expecting a format of '[power (0-9)] [time (0-9)]'
-          char space1 = client.read(); //empty space read
-          char power = client.read();
-          char space2 = client.read(); //empty space read
-          char time = client.read();
-
-          String outputmessage = "Going right at power and time: ";
-          outputmessage += power;
-          outputmessage += ' ';
-          outputmessage += time;
-          Serial.println(outputmessage);
-
-          //converting the chars to ints
-          int itime = time - '0';
-          int ipower = power - '0';
-
-          translate_right(ipower, itime);
-        }
-
-        // === SAMPLE SERVO CONTROL ===
-        if (c == 'o') {
-          servo_open();
-          Serial.println("O function triggered");
-        }
-        if (c == 'p') {
-          servo_close();
-          Serial.println("P function triggered");
-        }
-
-        client.write(c);         // Echo back to client
-      }
+    control_parser.cmd = 0;
+  }
+
+  for (int budget = CONTROL_RX_BUDGET; budget > 0 && control_client.available(); budget--) {
+    if (!scheduler_service_time_left()) {
+      scheduler_service_cutoff();
+      break;
+    }
+    char c = control_client.read();
+    Serial.write(c);         // Print to serial monitor
+    parse_control_byte(control_parser, c);
+  }
+}
+
+// Movement commands are followed by ' [power (0-9)] [time (0-9)]'. Time 0
+// runs the motion until the next command; 1-9 queues it for that many
+// half seconds (see motion_queue.h).
+static bool takes_arguments(char c) {
+  return c == 'f' || c == 'b' || c == 'l' || c == 'r' || c == 'a' || c == 'd';
+}
+
+// Incremental parser: bytes may arrive split across several loop() calls,
+// so a movement command is only run once its four argument bytes are in.
+void parse_control_byte(CommandParser& parser, char c) {
+  if (parser.cmd) {
+    parser.args[parser.nargs++] = c;
+    if (parser.nargs < 4) {
+      return;
     }
-    client.stop();
-    Serial.println("Client disconnected.");
+    //converting the chars to ints (args are ' ', power, ' ', time)
+    execute_command(parser.cmd, parser.args[1], parser.args[3]);
+    parser.cmd = 0;
+    return;
+  }
+
+  if (takes_arguments(c)) {
+    parser.cmd = c;
+    parser.nargs = 0;
+    return;
   }
+
+  execute_command(c, 0, 0);
 }
 
-// Function to read and process WiFi data from ESP32-CAM
+void execute_command(char c, char power, char time) {
+  // Toggle autonomous mode
+  if (c == 'm') {
+    autonomous_mode = !autonomous_mode;
+    if (autonomous_mode) {
+      Serial.println("Autonomous mode: ON");
+      motion_clear();
+      navigation_init();
+    } else {
+      Serial.println("Autonomous mode: OFF");
+      stop();
+    }
+    control_client.write(c); // Echo back
+    return;
+  }
+  
+  // If in autonomous mode, ignore manual commands (except 'm' and 's')
+  if (autonomous_mode && c != 's') {
+    control_client.write(c); // Echo back
+    return;
+  }
+
+  int itime = time - '0';
+  int ipower = power - '0';
+
+  if (takes_arguments(c) && itime > 0 && motion_queue_space() == 0) {
+    Serial.println("Motion queue full, command dropped");
+  }
+
+  //checking if one of standard commands
+  if (c == 's') {
+    //STOP
+    // call the stop function here
+    stop();
+    Serial.println("Motors Stopped");
+  }
+  if (c == 'f') {
+    //MOVE FORWARD
+    print_motion("Going forward at power and time: ", power, time);
+    go_forward(ipower, itime);
+  }
+
+  if (c == 'b') {
+    //MOVE BACKWARDS
+    print_motion("Going backwards at power and time: ", power, time);
+    go_backward(ipower, itime);
+  }
+
+  if (c == 'l') {
+    //ROTATE LEFT
+    print_motion("Rotating left at power and time: ", power, time);
+    turn_left(ipower, itime);
+  }
+
+  if (c == 'r') {
+    //ROTATE RIGHT
+    print_motion("Rotating right at power and time: ", power, time);
+    turn_right(ipower, itime);
+  }
+
+  if (c == 'a') {
+    //TRANSLATE LEFT
+    print_motion("Going left at power and time: ", power, time);
+    translate_left(ipower, itime);
+  }
+
+  if (c == 'd') {
+    //TRANSLATE RIGHT
+    print_motion("Going right at power and time: ", power, time);
+    translate_right(ipower, itime);
+  }
+
+  // === SAMPLE SERVO CONTROL ===
+  if (c == 'o') {
+    servo_open();
+    Serial.println("O function triggered");
+  }
+  if (c == 'p') {
+    servo_close();
+    Serial.println("P function triggered");
+  }
+
+  control_client.write(c);         // Echo back to client
+}
+
+void print_motion(const char* what, char power, char time) {
+  Serial.print(what);
+  Serial.print(power);
+  Serial.print(' ');
+  Serial.println(time);
+}
+
+// Function to read and process WiFi data from ESP32-CAM. Bytes go
+// straight from the socket into esp32cam_rx in bulk reads, at most
+// ESP32CAM_RX_BUDGET per call; when the ring is full the rest waits in
+// the socket.
 void read_esp32cam_data() {
   if (!esp32cam_client || !esp32cam_client.connected()) {
     return;
   }
-  
-  while (esp32cam_client.available()) {
-    char c = esp32cam_client.read();
-    
+
+  unsigned int budget = ESP32CAM_RX_BUDGET;
+  while (budget > 0 && esp32cam_client.available() > 0) {
+    if (!scheduler_service_time_left()) {
+      scheduler_service_cutoff();
+      break;
+    }
+    unsigned int n;
+    uint8_t* dst = rx_ring_write_ptr(esp32cam_rx, n);
+    if (n == 0) {
+      break;
+    }
+    if (n > budget) {
+      n = budget;
+    }
+    int got = esp32cam_client.read(dst, n);
+    if (got <= 0) {
+      break;
+    }
+    rx_ring_commit(esp32cam_rx, got);
+    budget -= got;
+  }
+
+  scan_esp32cam_data();
+}
+
+// Hand every complete message in esp32cam_rx to navigation, parsed where
+// it lies in the ring. A partial message is left for the next call.
+void scan_esp32cam_data() {
+  unsigned int avail;
+
+  while ((avail = rx_ring_count(esp32cam_rx)) > 0) {
+    // Binary QrFrame (qr_protocol.h): starts with a non-printable sync byte
+    if (rx_ring_peek(esp32cam_rx, 0) == QR_FRAME_SYNC0) {
+      if (avail < 2) {
+        return;
+      }
+      if (rx_ring_peek(esp32cam_rx, 1) != QR_FRAME_SYNC1) {
+        rx_ring_drop(esp32cam_rx, 1);
+        qr_frame_errors++;
+        continue;
+      }
+      if (avail < QR_FRAME_SIZE) {
+        return;
+      }
+      QrFrame frame;
+      if (!qr_frame_decode(rx_ring_linear(esp32cam_rx, QR_FRAME_SIZE, qr_scratch), frame)) {
+        // The sync bytes may have been payload, so a real frame or line
+        // could start anywhere after them: resync one byte on
+        rx_ring_drop(esp32cam_rx, 1);
+        qr_frame_errors++;
+        continue;
+      }
+      process_qr_frame(frame);
+      rx_ring_drop(esp32cam_rx, QR_FRAME_SIZE);
+      continue;
+    }
+
+    // Stray control bytes (e.g. left over from a bad frame) never start a line
+    uint8_t first = rx_ring_peek(esp32cam_rx, 0);
+    if (first != '\n' && (first < 32 || first > 126)) {
+      rx_ring_drop(esp32cam_rx, 1);
+      continue;
+    }
+
+    // Text line: find its end, or a frame starting before it
+    unsigned int limit = avail < QR_LINE_MAX ? avail : QR_LINE_MAX;
+    unsigned int len = 0;
+    uint8_t c = 0;
+    for (; len < limit; len++) {
+      c = rx_ring_peek(esp32cam_rx, len);
+      if (c == '\n' || c == QR_FRAME_SYNC0) {
+        break;
+      }
+    }
+
+    if (len == limit) {
+      if (limit < QR_LINE_MAX) {
+        return; // Rest of the line not here yet
+      }
+      // Prevent buffer overflow: drop what we have, the tail of the line
+      // then fails the "QR:" check
+      rx_ring_drop(esp32cam_rx, limit);
+      qr_line_overflows++;
+      continue;
+    }
+
     if (c == '\n') {
-      // End of line, process the buffer
-      if (qr_data_buffer.length() > 0) {
-        process_qr_data(qr_data_buffer.c_str());
-        qr_data_buffer = "";
+      const char* line = (const char*)rx_ring_linear(esp32cam_rx, len, qr_scratch);
+      int line_len = len;
+      if (line_len > 0 && line[line_len - 1] == '\r') {
+        line_len--;
       }
-    } else if (c >= 32 && c <= 126) {
-      // Printable character, add to buffer
-      qr_data_buffer += c;
-      
-      // Prevent buffer overflow
-      if (qr_data_buffer.length() > 128) {
-        qr_data_buffer = "";
+      if (line_len > 0) {
+        process_qr_data(line, line_len);
       }
+      rx_ring_drop(esp32cam_rx, len + 1);
+    } else {
+      // A frame cut this line short, so the line is incomplete
+      rx_ring_drop(esp32cam_rx, len);
     }
   }
-}
\ No newline at end of file
+}
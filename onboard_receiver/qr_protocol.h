@@ -0,0 +1,117 @@
+#ifndef QR_PROTOCOL_H
+#define QR_PROTOCOL_H
+
+// Binary QR telemetry between the ESP32-CAM and the Nano.
+//
+// This file is shared by both sketches: keep QR_demo/qr_protocol.h and
+// onboard_receiver/qr_protocol.h identical.
+//
+// Frame layout (QR_FRAME_SIZE bytes, multi-byte fields little-endian):
+//   0  sync       QR_FRAME_SYNC0, QR_FRAME_SYNC1
+//   2  version    QR_FRAME_VERSION
+//   3  side       QrSide
+//   4  seq        uint16, incremented per frame sent
+//   6  timestamp  uint32, camera capture time in ms (sender's clock)
+//  10  corners    4 x (int16 x, int16 y), top left then clockwise
+//  26  crc        uint16, CRC-16/CCITT-FALSE of bytes 2..25
+//
+// The sync bytes are outside the printable range, so a receiver can tell
+// a binary frame from a text "QR:<id>,<cx>,<cy>,<w>,<h>\n" line by its
+// first byte.
+
+#include <stdint.h>
+#include <string.h>
+
+#define QR_FRAME_SYNC0    0xAA
+#define QR_FRAME_SYNC1    0x55
+#define QR_FRAME_VERSION  1
+#define QR_FRAME_SIZE     28
+
+enum QrSide {
+  QR_SIDE_UNKNOWN = 0,
+  QR_SIDE_ID_FRONT,
+  QR_SIDE_ID_BACK,
+  QR_SIDE_ID_LEFT,
+  QR_SIDE_ID_RIGHT,
+  QR_SIDE_COUNT
+};
+
+struct QrFrame {
+  uint8_t side;               // QrSide
+  uint16_t seq;
+  uint32_t timestamp_ms;
+  int16_t corner_x[4];
+  int16_t corner_y[4];
+};
+
+// Payloads of the markers on each side, indexed by QrSide
+static const char *const qr_side_names[QR_SIDE_COUNT] = {
+  "", "FRONT", "BACK", "LEFT", "RIGHT"
+};
+
+static inline QrSide qr_side_from_id(const char *id) {
+  for (int i = 1; i < QR_SIDE_COUNT; i++) {
+    if (strcmp(id, qr_side_names[i]) == 0) return (QrSide)i;
+  }
+  return QR_SIDE_UNKNOWN;
+}
+
+static inline const char *qr_side_name(uint8_t side) {
+  return side < QR_SIDE_COUNT ? qr_side_names[side] : "";
+}
+
+static inline uint16_t qr_crc16(const uint8_t *buf, int len) {
+  uint16_t crc = 0xFFFF;
+  while (len--) {
+    crc ^= (uint16_t)*buf++ << 8;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static inline void qr_put16(uint8_t *p, uint16_t v) {
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+static inline uint16_t qr_get16(const uint8_t *p) {
+  return p[0] | ((uint16_t)p[1] << 8);
+}
+
+// Serialize a frame into buf, which must hold QR_FRAME_SIZE bytes.
+static inline void qr_frame_encode(const QrFrame &f, uint8_t *buf) {
+  buf[0] = QR_FRAME_SYNC0;
+  buf[1] = QR_FRAME_SYNC1;
+  buf[2] = QR_FRAME_VERSION;
+  buf[3] = f.side;
+  qr_put16(buf + 4, f.seq);
+  qr_put16(buf + 6, f.timestamp_ms & 0xFFFF);
+  qr_put16(buf + 8, f.timestamp_ms >> 16);
+  for (int k = 0; k < 4; k++) {
+    qr_put16(buf + 10 + k * 4, (uint16_t)f.corner_x[k]);
+    qr_put16(buf + 12 + k * 4, (uint16_t)f.corner_y[k]);
+  }
+  qr_put16(buf + 26, qr_crc16(buf + 2, 24));
+}
+
+// Parse QR_FRAME_SIZE bytes. Returns false on a bad sync word, version or
+// CRC, leaving f untouched.
+static inline bool qr_frame_decode(const uint8_t *buf, QrFrame &f) {
+  if (buf[0] != QR_FRAME_SYNC0 || buf[1] != QR_FRAME_SYNC1 ||
+      buf[2] != QR_FRAME_VERSION ||
+      qr_get16(buf + 26) != qr_crc16(buf + 2, 24)) {
+    return false;
+  }
+  f.side = buf[3];
+  f.seq = qr_get16(buf + 4);
+  f.timestamp_ms = qr_get16(buf + 6) | ((uint32_t)qr_get16(buf + 8) << 16);
+  for (int k = 0; k < 4; k++) {
+    f.corner_x[k] = (int16_t)qr_get16(buf + 10 + k * 4);
+    f.corner_y[k] = (int16_t)qr_get16(buf + 12 + k * 4);
+  }
+  return true;
+}
+
+#endif
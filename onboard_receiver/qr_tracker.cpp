@@ -0,0 +1,100 @@
+#include <Arduino.h>
+#include "qr_tracker.h"
+
+#define Q8(v) ((long)(v) * 256)
+
+static void axis_init(AxisTrack& a, int z) {
+  a.pos = Q8(z);
+  a.rate = 0;
+}
+
+// Position of the axis dt ms after its last update, Q8
+static long axis_predict(const AxisTrack& a, long dt) {
+  return a.pos + a.rate * dt / 1000;
+}
+
+// Move the axis to its prediction plus the weighted residual. The rate is
+// bounded so that a.rate * dt in axis_predict() stays within a 32-bit long
+// for any dt up to QR_TIMEOUT_MS.
+static void axis_correct(AxisTrack& a, long predicted, long residual, long dt) {
+  if (dt < QR_TRACK_MIN_DT_MS) dt = QR_TRACK_MIN_DT_MS;
+
+  a.pos = predicted + residual * QR_TRACK_ALPHA / 256;
+  a.rate += residual * QR_TRACK_BETA / 256 * 1000 / dt;
+  a.rate = constrain(a.rate, -Q8(QR_TRACK_MAX_RATE), Q8(QR_TRACK_MAX_RATE));
+}
+
+void qr_track_reset(QrTrack& track) {
+  memset(&track, 0, sizeof(track));
+}
+
+static void track_start(QrTrack& track, uint8_t side, int center_x, int width,
+                        unsigned long capture_time) {
+  axis_init(track.x, center_x);
+  axis_init(track.width, width);
+  track.time = capture_time;
+  track.side = side;
+  track.confidence = QR_TRACK_CONFIDENCE_STEP;
+  track.outliers = 0;
+  track.active = true;
+}
+
+void qr_track_update(QrTrack& track, uint8_t side, int center_x, int width,
+                     unsigned long capture_time) {
+  long dt = (long)(capture_time - track.time);
+
+  if (!track.active || track.side != side || dt >= QR_TIMEOUT_MS) {
+    track_start(track, side, center_x, width, capture_time);
+    return;
+  }
+  if (dt < 0) {
+    return;   // Out of order frame
+  }
+
+  // Nothing is stored until the measurement passes the gate, so a
+  // rejected one leaves the track as it was at track.time.
+  long px = axis_predict(track.x, dt);
+  long pw = axis_predict(track.width, dt);
+
+  long rx = Q8(center_x) - px;
+  long rw = Q8(width) - pw;
+
+  // A single width reading far from the prediction is more likely a bad
+  // corner than real motion. Only a run of them restarts the track.
+  if (labs(rw) > pw * QR_TRACK_GATE_PCT / 100) {
+    if (++track.outliers < QR_TRACK_MAX_OUTLIERS) {
+      return;
+    }
+    track_start(track, side, center_x, width, capture_time);
+    return;
+  }
+
+  axis_correct(track.x, px, rx, dt);
+  axis_correct(track.width, pw, rw, dt);
+  track.time = capture_time;
+  track.outliers = 0;
+  track.confidence = track.confidence + QR_TRACK_CONFIDENCE_STEP > 100 ?
+                     100 : track.confidence + QR_TRACK_CONFIDENCE_STEP;
+}
+
+// Predict center_x and width at now. Returns the confidence (0-100) of
+// the prediction, which falls to 0 as the last measurement ages to
+// QR_TIMEOUT_MS; center_x and width are left untouched when it is 0.
+uint8_t qr_track_predict(const QrTrack& track, unsigned long now,
+                         int& center_x, int& width) {
+  if (!track.active) {
+    return 0;
+  }
+
+  long age = (long)(now - track.time);
+  if (age < 0) age = 0;
+  if (age >= QR_TIMEOUT_MS) {
+    return 0;
+  }
+
+  long dt = age < QR_MAX_EXTRAPOLATION_MS ? age : QR_MAX_EXTRAPOLATION_MS;
+  center_x = (axis_predict(track.x, dt) + 128) / 256;
+  width = (axis_predict(track.width, dt) + 128) / 256;
+
+  return track.confidence * (QR_TIMEOUT_MS - age) / QR_TIMEOUT_MS;
+}
@@ -0,0 +1,32 @@
+#ifndef QR_TRACKER_H
+#define QR_TRACKER_H
+
+#include <stdint.h>
+#include "config.h"
+
+// Alpha-beta tracker for one marker's center_x and width. Values are kept
+// in Q8 fixed point (1/256 pixel) so the filter is cheap on the SAMD21,
+// which has no FPU.
+
+struct AxisTrack {
+  long pos;                     // Position, Q8 pixels
+  long rate;                    // Rate, Q8 pixels per second
+};
+
+struct QrTrack {
+  AxisTrack x;                  // center_x
+  AxisTrack width;              // width
+  unsigned long time;           // Capture time of the last accepted measurement
+  uint8_t side;                 // QrSide being tracked
+  uint8_t confidence;           // 0-100 at time, decays with age
+  uint8_t outliers;             // Consecutive measurements rejected by the gate
+  bool active;
+};
+
+void qr_track_reset(QrTrack& track);
+void qr_track_update(QrTrack& track, uint8_t side, int center_x, int width,
+                     unsigned long capture_time);
+uint8_t qr_track_predict(const QrTrack& track, unsigned long now,
+                         int& center_x, int& width);
+
+#endif
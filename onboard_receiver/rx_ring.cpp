@@ -0,0 +1,44 @@
+#include <string.h>
+#include "rx_ring.h"
+
+void rx_ring_reset(RxRing& ring) {
+  ring.head = 0;
+  ring.tail = 0;
+}
+
+unsigned int rx_ring_count(const RxRing& ring) {
+  return ring.head - ring.tail;
+}
+
+uint8_t* rx_ring_write_ptr(RxRing& ring, unsigned int& n) {
+  unsigned int start = ring.head & RX_RING_MASK;
+  unsigned int space = RX_RING_SIZE - rx_ring_count(ring);
+  unsigned int to_end = RX_RING_SIZE - start;
+
+  n = space < to_end ? space : to_end;
+  return ring.data + start;
+}
+
+void rx_ring_commit(RxRing& ring, unsigned int n) {
+  ring.head += n;
+}
+
+uint8_t rx_ring_peek(const RxRing& ring, unsigned int offset) {
+  return ring.data[(ring.tail + offset) & RX_RING_MASK];
+}
+
+const uint8_t* rx_ring_linear(const RxRing& ring, unsigned int n, uint8_t* scratch) {
+  unsigned int start = ring.tail & RX_RING_MASK;
+  unsigned int to_end = RX_RING_SIZE - start;
+
+  if (n <= to_end) {
+    return ring.data + start;
+  }
+  memcpy(scratch, ring.data + start, to_end);
+  memcpy(scratch + to_end, ring.data, n - to_end);
+  return scratch;
+}
+
+void rx_ring_drop(RxRing& ring, unsigned int n) {
+  ring.tail += n;
+}
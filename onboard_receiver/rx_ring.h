@@ -0,0 +1,41 @@
+#ifndef RX_RING_H
+#define RX_RING_H
+
+#include <stdint.h>
+#include "config.h"
+
+// Fixed-size byte ring for socket data. Indices run freely and are masked
+// on access, so head - tail is always the fill level. The writer fills
+// the contiguous span from rx_ring_write_ptr() with one bulk read; the
+// reader looks at bytes in place and drops them once used.
+
+#define RX_RING_SIZE ESP32CAM_RX_RING
+#define RX_RING_MASK (RX_RING_SIZE - 1)
+
+#if RX_RING_SIZE & RX_RING_MASK
+#error "ESP32CAM_RX_RING must be a power of two"
+#endif
+
+struct RxRing {
+  uint8_t data[RX_RING_SIZE];
+  unsigned int head;            // Next byte to write
+  unsigned int tail;            // Next byte to read
+};
+
+void rx_ring_reset(RxRing& ring);
+unsigned int rx_ring_count(const RxRing& ring);
+
+// Contiguous free space at the head, and its length in n. Call
+// rx_ring_commit() with the number of bytes actually written.
+uint8_t* rx_ring_write_ptr(RxRing& ring, unsigned int& n);
+void rx_ring_commit(RxRing& ring, unsigned int n);
+
+uint8_t rx_ring_peek(const RxRing& ring, unsigned int offset);
+
+// The first n bytes as one block: a pointer into the ring, or, when they
+// wrap past the end, a copy in scratch (which must hold n bytes).
+const uint8_t* rx_ring_linear(const RxRing& ring, unsigned int n, uint8_t* scratch);
+
+void rx_ring_drop(RxRing& ring, unsigned int n);
+
+#endif
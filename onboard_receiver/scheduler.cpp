@@ -0,0 +1,78 @@
+#include <Arduino.h>
+#include "scheduler.h"
+
+static unsigned long next_tick = 0;
+static unsigned long tick_start = 0;
+static unsigned long service_deadline = 0;
+static bool cutoff_counted = false;
+static SchedulerStats stats = {0};
+
+void scheduler_init() {
+  next_tick = micros();
+  service_deadline = next_tick;
+  memset(&stats, 0, sizeof(stats));
+}
+
+// Returns true when the next control tick is due, and starts timing it.
+bool scheduler_tick_due() {
+  unsigned long now = micros();
+  long late = (long)(now - next_tick);
+
+  if (late < 0) {
+    return false;
+  }
+
+  if ((unsigned long)late > stats.max_jitter_us) {
+    stats.max_jitter_us = late;
+  }
+
+  if ((unsigned long)late >= CONTROL_PERIOD_US) {
+    // Fell behind by a whole period: skip the missed ticks rather than
+    // running them back to back.
+    stats.overruns++;
+    next_tick = now + CONTROL_PERIOD_US;
+  } else {
+    next_tick += CONTROL_PERIOD_US;
+  }
+
+  tick_start = now;
+  stats.ticks++;
+  return true;
+}
+
+void scheduler_tick_done() {
+  unsigned long now = micros();
+  unsigned long duration = now - tick_start;
+
+  if (duration > stats.max_tick_us) {
+    stats.max_tick_us = duration;
+  }
+
+  // Sockets get their budget, but never past the next tick
+  service_deadline = now + CONTROL_SOCKET_BUDGET_US;
+  if ((long)(service_deadline - next_tick) > 0) {
+    service_deadline = next_tick;
+  }
+  cutoff_counted = false;
+}
+
+// True while socket servicing may continue in this period.
+bool scheduler_service_time_left() {
+  return (long)(micros() - service_deadline) < 0;
+}
+
+// Called when a socket still had data when its time ran out. Counted
+// once per period.
+void scheduler_service_cutoff() {
+  if (!cutoff_counted) {
+    stats.socket_cutoffs++;
+    cutoff_counted = true;
+  }
+}
+
+// Return the counters gathered since the last call and reset them.
+SchedulerStats scheduler_take_stats() {
+  SchedulerStats taken = stats;
+  memset(&stats, 0, sizeof(stats));
+  return taken;
+}
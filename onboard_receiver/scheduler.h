@@ -0,0 +1,25 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "config.h"
+
+// Fixed-rate control tick for loop(). The tick runs every
+// CONTROL_PERIOD_US; the time left over is shared by socket servicing,
+// which may use at most CONTROL_SOCKET_BUDGET_US of it per tick.
+
+struct SchedulerStats {
+  unsigned long ticks;          // Control ticks run
+  unsigned long overruns;       // Ticks started a whole period late (missed ticks skipped)
+  unsigned long max_jitter_us;  // Latest tick start after its due time
+  unsigned long max_tick_us;    // Longest tick
+  unsigned long socket_cutoffs; // Periods in which socket data was left for later
+};
+
+void scheduler_init();
+bool scheduler_tick_due();
+void scheduler_tick_done();
+bool scheduler_service_time_left();
+void scheduler_service_cutoff();
+SchedulerStats scheduler_take_stats();
+
+#endif
@@ -0,0 +1,159 @@
+#include <Arduino.h>
+#include "speed_control.h"
+#include "motor_control.h"
+
+#if SPEED_CONTROL
+
+#ifndef ARDUINO_ARCH_SAMD
+#error "SPEED_CONTROL uses the SAMD21's TC5"
+#endif
+
+// Distance covered per encoder pulse, in micrometres
+#define UM_PER_PULSE ((long)WHEEL_DIAMETER_MM * 3142L / ENCODER_PULSES_PER_REV)
+
+// Timer clock: GCLK0 (48 MHz) / 1024
+#define SPEED_TIMER_HZ (48000000L / 1024)
+
+struct WheelLoop {
+  volatile unsigned long last_pulse_us;
+  volatile unsigned long period_us;   // Between the last two pulses, 0 if none yet
+  volatile int target;                // mm/s, signed
+  int measured;                       // mm/s, unsigned
+  long integral;                      // PWM, in 1/256
+};
+
+static WheelLoop wheels[3];
+static const int encoder_pins[3] = { ENCODER_PIN_1, ENCODER_PIN_2, ENCODER_PIN_3 };
+
+static void encoder_pulse(int i) {
+  unsigned long now = micros();
+  wheels[i].period_us = now - wheels[i].last_pulse_us;
+  wheels[i].last_pulse_us = now;
+}
+
+static void encoder_isr_1() { encoder_pulse(0); }
+static void encoder_isr_2() { encoder_pulse(1); }
+static void encoder_isr_3() { encoder_pulse(2); }
+
+// Speed from the pulse period rather than a pulse count per loop: with a
+// few dozen pulses per second a count would read 0 or 1 most of the time.
+// While waiting for the next pulse, the time since the last one bounds
+// the speed from above, so a stalling wheel reads as slowing down at once.
+static int measure(unsigned long period, unsigned long last_pulse_us,
+                   unsigned long now) {
+  unsigned long since = now - last_pulse_us;
+
+  if (period == 0 || since > SPEED_STALL_MS * 1000UL) {
+    return 0;
+  }
+  if (since > period) {
+    period = since;
+  }
+  return UM_PER_PULSE * 1000L / (long)period;
+}
+
+static long wheel_output(WheelLoop &w, unsigned long period,
+                         unsigned long last_pulse_us, unsigned long now) {
+  int target = w.target;
+  int previous = w.measured;
+  w.measured = measure(period, last_pulse_us, now);
+
+  if (target == 0) {
+    w.integral = 0;
+    return 0;
+  }
+
+  // Work in the direction of travel, then restore the sign
+  long speed = abs(target);
+  long error = speed - w.measured;
+  long ff = speed * global_max_speed / SPEED_MAX_MM_S;
+  long p = (long)SPEED_KP * error;
+  long d = -(long)SPEED_KD * (w.measured - previous);
+  long out = ff + (p + w.integral + d) / 256;
+
+  // Anti-windup: only integrate while the output has room to move in the
+  // direction the error asks for
+  if (!(out >= global_max_speed && error > 0) && !(out <= 0 && error < 0)) {
+    w.integral += (long)SPEED_KI * error;
+    w.integral = constrain(w.integral, -256L * global_max_speed, 256L * global_max_speed);
+  }
+
+  out = constrain(out, 0L, (long)global_max_speed);
+  return target > 0 ? out : -out;
+}
+
+void TC5_Handler() {
+  TC5->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0;
+
+  // The encoder interrupts can preempt this one, so take each wheel's
+  // pulse times as a consistent pair
+  unsigned long period[3], last[3];
+  noInterrupts();
+  for (int i = 0; i < 3; i++) {
+    period[i] = wheels[i].period_us;
+    last[i] = wheels[i].last_pulse_us;
+  }
+  interrupts();
+
+  unsigned long now = micros();
+  set_motors(wheel_output(wheels[0], period[0], last[0], now),
+             wheel_output(wheels[1], period[1], last[1], now),
+             wheel_output(wheels[2], period[2], last[2], now));
+}
+
+static void tc5_sync() {
+  while (TC5->COUNT16.STATUS.bit.SYNCBUSY);
+}
+
+void speed_control_init() {
+  static void (*const isrs[3])() = { encoder_isr_1, encoder_isr_2, encoder_isr_3 };
+
+  memset(wheels, 0, sizeof(wheels));
+  for (int i = 0; i < 3; i++) {
+    pinMode(encoder_pins[i], INPUT_PULLUP);
+    attachInterrupt(digitalPinToInterrupt(encoder_pins[i]), isrs[i], RISING);
+  }
+
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 |
+                      GCLK_CLKCTRL_ID(GCM_TC4_TC5);
+  while (GCLK->STATUS.bit.SYNCBUSY);
+
+  TC5->COUNT16.CTRLA.reg &= ~TC_CTRLA_ENABLE;
+  tc5_sync();
+  TC5->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ |
+                           TC_CTRLA_PRESCALER_DIV1024;
+  tc5_sync();
+  TC5->COUNT16.CC[0].reg = SPEED_TIMER_HZ / SPEED_LOOP_HZ - 1;
+  tc5_sync();
+  TC5->COUNT16.INTENSET.reg = TC_INTENSET_MC0;
+
+  NVIC_SetPriority(TC5_IRQn, 2);
+  NVIC_EnableIRQ(TC5_IRQn);
+
+  TC5->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
+  tc5_sync();
+}
+
+void speed_set_targets(int mm_s_1, int mm_s_2, int mm_s_3) {
+  noInterrupts();
+  wheels[0].target = mm_s_1;
+  wheels[1].target = mm_s_2;
+  wheels[2].target = mm_s_3;
+  interrupts();
+}
+
+void speed_stop() {
+  noInterrupts();
+  for (int i = 0; i < 3; i++) {
+    wheels[i].target = 0;
+    wheels[i].integral = 0;
+  }
+  set_motors(0, 0, 0);
+  interrupts();
+}
+
+int speed_measured(int motor) {
+  return wheels[motor].measured;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef SPEED_CONTROL_H
+#define SPEED_CONTROL_H
+
+#include "config.h"
+
+// Per-wheel closed-loop speed control, enabled by SPEED_CONTROL. Each
+// wheel's encoder pulses are timed in a pin interrupt; a timer interrupt
+// at SPEED_LOOP_HZ turns the pulse period into a speed, runs a PI(D) loop
+// against the set-point and writes the result through set_motors().
+//
+// Encoders give pulses but no direction, so each wheel is assumed to turn
+// the way it is being driven.
+
+void speed_control_init();
+
+// Signed wheel speeds in mm/s, positive meaning hbridge_1 HIGH as in
+// set_motors(). All three are taken together by the next loop run.
+void speed_set_targets(int mm_s_1, int mm_s_2, int mm_s_3);
+
+// Zero all set-points and cut the motors now rather than at the next
+// loop run.
+void speed_stop();
+
+// Last measured speed of a wheel (0-2) in mm/s, unsigned.
+int speed_measured(int motor);
+
+#endif
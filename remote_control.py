@@ -5,7 +5,7 @@ ARUINO_IP = "192.168.4.1"
 ARUINO_PORT = 8080
 # Default values setup
 power = 5
-duration = 1
+duration = 0  # 0 = run until the next command (keys are held)
 stop_command = 's'
 
 #Mapping the movements of keys to Arduino command